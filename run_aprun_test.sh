@@ -25,14 +25,17 @@ output_dir="$HOME"
 ###############
 
 logfile="$output_dir/sndrcv-test.log"
+srvr_results="$output_dir/sndrcv-srvr.csv"      # result records (CSV)
+client_results="$output_dir/sndrcv-client.csv"
 server="$umbrella_bin_dir/sndrcv-srvr"
 client="$umbrella_bin_dir/sndrcv-client"
 
 message () { echo "$@" | tee -a $logfile; }
 die () { message "Error $@"; exit 1; }
 
-rm $logfile
+rm -f $logfile $srvr_results $client_results
 message "Output is available in $logfile"
+message "Results are in $client_results and $srvr_results"
 
 host1=$(cat $PBS_NODEFILE | uniq | sort | head -n 1 | tr '\n' ',')
 host2=$(cat $PBS_NODEFILE | uniq | sort -r | head -n 1 | tr '\n' ',')
@@ -47,16 +50,19 @@ message "Host 2: hostname = $host2, ip = $host2_ip"
 
 protos=("bmi+tcp" "cci+tcp" "cci+gni")
 instances=(1 2 4 8)
+layouts=("per-instance" "shared" "per-process")  # HG class per instance,
+                                        # shared, or process per instance
 repeats=3
 
 run_one() {
     proto="$1"
     num="$2"
     iter=$3
+    layout="$4"
 
     message ""
     message "====================================================="
-    message "Testing protocol '$proto' with $num Mercury instances"
+    message "Testing protocol '$proto' with $num Mercury instances ($layout class)"
     message "Iteration $iter out of $repeats"
     message "====================================================="
     message ""
@@ -64,16 +70,26 @@ run_one() {
     address1="${proto}://$host1_ip:%d"
     address2="${proto}://$host2_ip:%d"
 
+    # SHAREDCLASS (or FORK) must be set on both sides to use that layout
+    unset SHAREDCLASS FORK
+    if [ $layout == "shared" ]; then
+        export SHAREDCLASS=1
+    elif [ $layout == "per-process" ]; then
+        export FORK=1
+    fi
+
     # Start the server
     message "Starting server (Instances: $num, Address spec: $address1)."
-    aprun -L $host1 -n 1 -N 1 $server $num $address1 2>&1 >> $logfile &
+    RESULTS=$srvr_results aprun -L $host1 -n 1 -N 1 $server $num $address1 \
+        2>&1 >> $logfile &
 
     server_pid=$!
 
     # Start the client
     message "Starting client (Instances: $num, Address spec: $address2)."
     message "Please be patient while the test is in progress..."
-    aprun -L $host2 -n 1 -N 1 $client $num $address2 $address1 2>&1 >> $logfile
+    RESULTS=$client_results aprun -L $host2 -n 1 -N 1 $client $num \
+        $address2 $address1 2>&1 >> $logfile
 
     # Collect return codes
     client_ret=$?
@@ -94,15 +110,18 @@ run_one() {
 
 for proto in ${protos[@]}; do
     for num in ${instances[@]}; do
-        # BMI doesn't do well with >1 instances, so avoid those tests
-        if [[ $proto == "bmi+tcp" && $num -gt 1 ]]; then
-            continue;
-        fi
-
-        i=1
-        while [ $i -le $repeats ]; do
-            run_one $proto $num $i
-            i=$((i + 1))
+        for layout in ${layouts[@]}; do
+            # BMI doesn't do well with >1 instances in one process, so
+            # only run those tests with a process per instance
+            if [[ $proto == "bmi+tcp" && $num -gt 1 &&
+                  $layout != "per-process" ]]; then
+                continue;
+            fi
+            i=1
+            while [ $i -le $repeats ]; do
+                run_one $proto $num $i $layout
+                i=$((i + 1))
+            done
         done
     done
 done
@@ -0,0 +1,122 @@
+#!/bin/bash -eu
+#
+# run_local_sweep.sh  run a transport x instances x size matrix on localhost
+#
+# usage: ./run_local_sweep.sh [server-binary client-binary]
+#
+# runs the server and the client on this machine for every transport
+# and instance count listed below, with the client sweeping over the
+# RPC sizes (SIZE list).  each client run appends records to one
+# results table (CSV, see RESULTS in the README) in $outdir/results.csv.
+# the rows with instance "all" are the aggregate over all instances.
+# the server's records go in $outdir/srvr.csv.
+#
+# to check for a performance regression (e.g. between two versions of
+# mercury), set BASELINE to a results.csv from an earlier sweep.  we
+# compare the aggregate ops/sec of each matching client run and exit
+# non-zero if any of them dropped by more than TOLERANCE percent.
+#
+# the tunable parameters below can be overridden from the environment
+# (e.g. PROTOS="bmi+tcp" INSTANCES="1 2" ./run_local_sweep.sh).
+#
+
+######################
+# Tunable parameters #
+######################
+
+protos=(${PROTOS:-"bmi+tcp" "cci+tcp"})
+instances=(${INSTANCES:-1 2 4})
+sizes="${SIZES:-0,64,1k,4k,16k,64k}"
+count="${COUNT:-10000}"
+host="${HOST:-127.0.0.1}"
+outdir="${OUTDIR:-$(mktemp -d)}"
+tag="${RESULTS_TAG:-}"
+baseline="${BASELINE:-}"
+tolerance="${TOLERANCE:-10}"
+
+###############
+# Core script #
+###############
+
+server="${1:-./sndrcv-srvr}"
+client="${2:-./sndrcv-client}"
+logfile="$outdir/sweep.log"
+results="$outdir/results.csv"
+srvr_results="$outdir/srvr.csv"
+failed=0
+
+message () { echo "$@" | tee -a $logfile; }
+die () { message "Error $@"; exit 1; }
+
+mkdir -p $outdir
+rm -f $logfile $results $srvr_results
+message "Output is available in $logfile, results in $results"
+[ -x $server ] || die "server binary $server not found"
+[ -x $client ] || die "client binary $client not found"
+
+run_one() {
+    proto="$1"
+    num="$2"
+
+    message ""
+    message "====================================================="
+    message "Testing protocol '$proto' with $num Mercury instances"
+    message "====================================================="
+
+    address="${proto}://$host:%d"
+
+    RESULTS=$srvr_results RESULTS_TAG=$tag $server $num $address \
+        >> $logfile 2>&1 &
+    server_pid=$!
+
+    # the client waits for the server to answer before it starts
+    set +e
+    RESULTS=$results RESULTS_TAG=$tag COUNT=$count SIZE=$sizes QUIET=1 \
+        $client $num $address $address >> $logfile 2>&1
+    client_ret=$?
+    wait $server_pid
+    server_ret=$?
+    set -e
+
+    if [[ $client_ret != 0 || $server_ret != 0 ]]; then
+        message "Error: client returned $client_ret, server $server_ret."
+        failed=1
+    else
+        message "Test completed successfully."
+    fi
+}
+
+for proto in ${protos[@]}; do
+    for num in ${instances[@]}; do
+        run_one $proto $num
+    done
+done
+
+# print the aggregate client rows as a table
+message ""
+awk -F, 'NR == 1 || ($1 == "client" && $5 == "all") {
+             printf "%-10s %5s %8s %8s %12s %10s %10s\n", $3, $4, $12, $13,
+                    $18, $24, $26 }' $results | tee -a $logfile
+
+if [ -n "$baseline" ]; then
+    message ""
+    message "Comparing against $baseline (tolerance $tolerance%)"
+    # key: transport,ninst,layout,progress,affinity,mode,window,rate,sizes,handles
+    if ! awk -F, -v tol=$tolerance '
+        function key() { return $3","$4","$6","$7","$8","$9","$10","$11","$12","$13","$14","$15 }
+        $1 != "client" || $5 != "all" { next }
+        NR == FNR { base[key()] = $18; next }
+        (key() in base) && base[key()] > 0 {
+            drop = 100 * (base[key()] - $18) / base[key()]
+            flag = (drop > tol) ? "REGRESSION" : "ok"
+            printf "%s: %s ops/sec %.1f -> %.1f (%+.1f%%)\n", flag, key(),
+                   base[key()], $18, -drop
+            if (drop > tol) bad = 1
+        }
+        END { exit bad }' $baseline $results > $outdir/compare.txt; then
+        failed=1
+    fi
+    cat $outdir/compare.txt | tee -a $logfile
+fi
+
+exit $failed
@@ -18,6 +18,7 @@
 ######################
 
 umbrella_bin_dir="$HOME/src/deltafs-umbrella/install/bin"
+results_dir="$HOME"    # must be visible on both hosts
 
 ###############
 # Core script #
@@ -26,12 +27,16 @@ umbrella_bin_dir="$HOME/src/deltafs-umbrella/install/bin"
 logfile=$(mktemp)
 server="$umbrella_bin_dir/sndrcv-srvr"
 client="$umbrella_bin_dir/sndrcv-client"
+srvr_results="$results_dir/sndrcv-srvr.csv"      # result records (CSV)
+client_results="$results_dir/sndrcv-client.csv"
 
 message () { echo "$@" | tee -a $logfile; }
 die () { message "Error $@"; exit 1; }
 
 rm $logfile
+rm -f $srvr_results $client_results
 message "Output is available in $logfile"
+message "Results are in $client_results and $srvr_results"
 
 host1=$(/share/testbed/bin/emulab-listall | \
         awk -F, '{ print $1 "'"`hostname | sed 's/^[^\.]*././'`"'"}')
@@ -48,16 +53,19 @@ message "Host 2: hostname = $host2, ip = $host2_ip"
 
 protos=("bmi+tcp" "cci+tcp" "cci+gni")
 instances=(1 2 4 8)
+layouts=("per-instance" "shared" "per-process")  # HG class per instance,
+                                        # shared, or process per instance
 repeats=3
 
 run_one() {
     proto="$1"
     num="$2"
     iter=$3
+    layout="$4"
 
     message ""
     message "====================================================="
-    message "Testing protocol '$proto' with $num Mercury instances"
+    message "Testing protocol '$proto' with $num Mercury instances ($layout class)"
     message "Iteration $iter out of $repeats"
     message "====================================================="
     message ""
@@ -65,9 +73,21 @@ run_one() {
     address1="${proto}://$host1_ip:%d"
     address2="${proto}://$host2_ip:%d"
 
+    # SHAREDCLASS (or FORK) must be set on both sides to use that layout
+    mpi_env=()
+    unset SHAREDCLASS FORK
+    if [ $layout == "shared" ]; then
+        export SHAREDCLASS=1
+        mpi_env=(-x SHAREDCLASS)
+    elif [ $layout == "per-process" ]; then
+        export FORK=1
+        mpi_env=(-x FORK)
+    fi
+
     # Start the server
     message "Starting server (Instances: $num, Address spec: $address1)."
-    mpirun.openmpi -np 1 --host $host1 -tag-output $server $num $address1 \
+    mpirun.openmpi -np 1 --host $host1 -tag-output ${mpi_env[@]+"${mpi_env[@]}"} \
+        -x RESULTS=$srvr_results $server $num $address1 \
         2>&1 >> $logfile &
 
     server_pid=$!
@@ -75,7 +95,8 @@ run_one() {
     # Start the client
     message "Starting client (Instances: $num, Address spec: $address2)."
     message "Please be patient while the test is in progress..."
-    mpirun.openmpi -np 1 --host $host2 -tag-output $client $num $address2 \
+    mpirun.openmpi -np 1 --host $host2 -tag-output ${mpi_env[@]+"${mpi_env[@]}"} \
+        -x RESULTS=$client_results $client $num $address2 \
         $address1 2>&1 >> $logfile
 
     # Collect return codes
@@ -97,15 +118,18 @@ run_one() {
 
 for proto in ${protos[@]}; do
     for num in ${instances[@]}; do
-        # BMI doesn't do well with >1 instances, so avoid those tests
-        if [[ $proto == "bmi+tcp" && $num -gt 1 ]]; then
-            continue;
-        fi
-
-        i=1
-        while [ $i -le $repeats ]; do
-            run_one $proto $num $i
-            i=$((i + 1))
+        for layout in ${layouts[@]}; do
+            # BMI doesn't do well with >1 instances in one process, so
+            # only run those tests with a process per instance
+            if [[ $proto == "bmi+tcp" && $num -gt 1 &&
+                  $layout != "per-process" ]]; then
+                continue;
+            fi
+            i=1
+            while [ $i -le $repeats ]; do
+                run_one $proto $num $i $layout
+                i=$((i + 1))
+            done
         done
     done
 done
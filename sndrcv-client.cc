@@ -5,7 +5,9 @@
 
 /*
  * this program contains a mercury RPC client that sends "count"
- * number of RPC requests and exits when all the replies in.
+ * number of RPC requests and exits when all the replies in.  when it
+ * is finished it sends each server instance a "done" RPC ("d%d") to
+ * tell it to exit.
  *
  * the program can run multiple instances of the mercury client
  * in the same process.   server port numbers are assigned
@@ -13,12 +15,215 @@
  * (the address spec uses a printf "%d" to fill the port number...)
  * we init the client side with ports after that...
  *
- * there are two sending modes: normally the client sends the
+ * there are three sending modes: normally the client sends the
  * RPC requests in parallel, but if you setenv "SERIALSEND" it
  * will wait an RPC request to complete before sending the next one.
+ * if you setenv "WINDOW" to a number, it will keep at most that many
+ * RPC requests in flight at once (SERIALSEND is the same as WINDOW=1,
+ * and WINDOW=0 is the same as the default parallel mode).
+ *
+ * WINDOW can also be a list of sizes (e.g. "1,4,16" or "1-64", where
+ * a range doubles from the low to the high value).  in that case we
+ * sweep over the window sizes: each instance runs one phase of "count"
+ * RPC requests for each window size and we print the throughput and
+ * latency for each phase.
+ *
+ * each RPC request and reply carries an opaque payload.  the size of
+ * the request payload is set with "INSIZE" and the size of the reply
+ * payload with "OUTSIZE" (default 0 bytes for both).  these can also
+ * be lists (e.g. "8-64k"), in which case we sweep over all combinations
+ * of window, request size and reply size.  to sweep a symmetric RPC
+ * size, set "SIZE" instead (request and reply size step together).
+ * each phase reports ops/sec and MB/s of payload moved.
+ *
+ * if you setenv "BULK" to "pull" or "push" we run in bulk mode.  the
+ * client registers a buffer with HG_Bulk_create() and sends its bulk
+ * handle in a bulk RPC ("b%d").  the server then pulls data from the
+ * buffer (or pushes data into it) with HG_Bulk_transfer() before it
+ * responds.  the transfer size is set with "BULKSIZE" (default 64k),
+ * which may be a list to sweep over.  the payload sizes are not used
+ * in bulk mode.
+ *
+ * normally we HG_Create() a new handle for each RPC and HG_Destroy() it
+ * when the reply comes in.  if you setenv "HANDLEPOOL=1" we instead
+ * create a pool of handles at the start of each phase (one per RPC that
+ * can be in flight) and recycle them with HG_Reset() before each reuse.
+ * mercury holds a handle until its completion callback returns to
+ * HG_Trigger(), so a request (and its handle) only goes back on the free
+ * list after that (see release_reqs()).  set "HANDLEPOOL=0,1" to run
+ * each phase both ways and print how much time per RPC the pool saves.
+ *
+ * the RPC input and output are normally encoded by the procs that
+ * MERCURY_GEN_PROC makes.  if you setenv "ZEROCOPY=1" we send the
+ * server's zero-copy RPC ("z%d") instead, which uses the hand-written
+ * procs in sndrcv-rpc.h: the payload goes straight into mercury's buffer
+ * and is read in place on the other side.  set "ZEROCOPY=0,1" to run
+ * each phase both ways, and main prints a table comparing the ops/sec,
+ * cpu nsec/rpc, and p50 latency of the two at each payload size.
+ *
+ * when a reply comes in the network thread takes the instance's lock to
+ * count it and put its request back on the free list, and signals the
+ * sender's cond var if it is waiting.  setenv "LOCKFREE=1" to do this
+ * with atomics instead: the free requests go on a lock-free queue and a
+ * waiting sender polls for "LOCKFREE_SPIN" usec (default 50) before it
+ * sleeps on a futex, so the network thread only makes a system call to
+ * wake a sender that is asleep.  set "LOCKFREE=0,1" to run each phase
+ * both ways and print how much time per RPC the lock-free path saves
+ * (this handoff is on the critical path with SERIALSEND).
+ *
+ * normally each instance's network thread drives HG_Progress() and
+ * HG_Trigger(), so each reply crosses from it to the sending thread.
+ * setenv "INLINE=1" to have the sending thread drive progress itself
+ * instead (the network thread is parked for the phase): it triggers
+ * callbacks after each send, and makes progress (using the PROGRESS
+ * policy) while it waits for the window, for its RPCs to complete, or
+ * for an open loop send time.  set "INLINE=0,1" to run each phase both
+ * ways and print how the time, cpu, and latency per RPC compare.
+ *
+ * traffic normally only flows from the client to the server.  setenv
+ * "BIDIR" (on the server too) to send it both ways: for each RPC it
+ * serves, the server sends the client instance an RPC ("v%d") with the
+ * same payload and reply sizes, and the instance serves it on the same
+ * context its own RPCs use (in the thread that drives progress).  each
+ * phase reports the reverse RPCs served and their rate next to our own
+ * ops/sec and latency, and the server reports the reverse latency, so
+ * we can see how much requests and replies going both ways through one
+ * progress loop and trigger queue slow each other down.
+ *
+ * the network thread normally blocks in HG_Progress() for up to 100ms
+ * when there is nothing to do.  setenv "PROGRESS" to "busy" to poll
+ * with a zero timeout instead, or to "spin:N" to poll for N usec before
+ * blocking.  each phase reports the CPU time used (by the instance's
+ * sending and network threads) per RPC, so the latency and CPU cost of
+ * each policy can be compared.
+ *
+ * the threads are normally left where the scheduler puts them.  setenv
+ * "AFFINITY" to pin each instance's sending (app) thread and network
+ * thread: "core" puts both on one cpu, "sibling" on the two hyperthreads
+ * of one core, "numa" on two cores of the same numa node, and "cross"
+ * on cores of two different numa nodes.  "cpus:a,b,c,..." lists the
+ * cpus to use (app, network, app, network, ...).  the server takes the
+ * same setting.  the chosen cpus are printed at startup.
+ *
+ * normally each instance has its own mercury class (HG_Init) and
+ * context.  if you setenv "SHAREDCLASS" we HG_Init one class for the
+ * whole process and give each instance its own context of that class
+ * (HG_Context_create_id()), each driven by its own network thread.  the
+ * server must be run with SHAREDCLASS too: it then listens on BASEPORT
+ * only and instance n's RPCs are sent to its context n (using
+ * HG_Set_target_id()).  run the test with different numbers of instances
+ * to see how throughput and latency scale in each layout.
+ *
+ * each RPC is timestamped when it is forwarded and again when its
+ * completion callback runs.   the results are recorded in a per-instance
+ * latency histogram and we print min/p50/p90/p99/p99.9/max for each
+ * instance and for all instances merged together at the end of the run.
+ *
+ * normally the client is closed loop: it sends a new RPC as soon as
+ * the window allows.  if you setenv "RATE" to a number of RPCs per
+ * second, each instance runs open loop instead: it sends RPCs on a
+ * schedule at that rate (spaced evenly, or with exponentially distributed
+ * gaps if you setenv "ARRIVAL=poisson") whether or not earlier RPCs have
+ * completed.  latency is measured from when each RPC was supposed to be
+ * sent, so a slow server can't hide its delays by holding back the load
+ * (coordinated omission).  RATE can be a list (e.g. "1k-256k") to sweep
+ * the offered load, in which case we report the knee: the highest rate
+ * that was sustained (throughput >= 95% of offered) without the p99
+ * latency growing to more than KNEE_LAT times its value at the lowest
+ * rate.  a WINDOW still limits the number of RPCs in flight (a send that
+ * has to wait for the window is late, and its latency shows it).
+ *
+ * if you setenv "DURATION" to a number of seconds, each phase sends
+ * RPCs for that long instead of sending "count" of them (in this mode
+ * an unlimited window is capped at "count" RPCs in flight).  each
+ * instance prints interval stats (ops/sec, p50/p99 latency, and the
+ * number of RPCs in flight) every "INTERVAL" seconds (default 1 in
+ * duration mode, 0=off).  the alarm is extended by the total duration
+ * of the run, so long soak runs are not killed.
+ *
+ * the first RPCs of a run pay for connection setup, first touch of
+ * memory, and lazy initialization in mercury and NA.  setenv "WARMUP"
+ * to a number of RPCs (e.g. "1000") or seconds (e.g. "2s") to start each
+ * phase with a warm-up: the instance sends that much of the phase's
+ * traffic, waits for it to complete, and throws away its stats before
+ * it starts the clock.  setenv "STEADY" to a tolerance in percent to
+ * end each phase early once throughput has settled: we measure the
+ * throughput of each "STEADY_SLICE" msec slice (default 100) and stop
+ * sending when the last STEADY_SLICES slices are all within STEADY
+ * percent of their average (the phase still stops at count RPCs, or
+ * after DURATION, if that comes first).  each phase prints its warm-up
+ * and the time it took to reach steady state.
+ *
+ * at startup each instance looks up its server's address (retrying
+ * with backoff if the lookup fails) and then pings the server with a
+ * "ready" RPC ("r%d") until it answers.  once every instance has heard
+ * from its server, all instances start sending at the same time.  we
+ * print the time it took each instance to get ready.  the server's
+ * reply gives the instance an "origin" number that it puts in each of
+ * its RPCs, so a server serving several clients can keep stats for
+ * each of them.
+ *
+ * at scale, looking up and connecting to many peers can dominate job
+ * startup.  setenv "LOOKUP" to a number of rounds to benchmark it: once
+ * all instances are ready, each instance looks up every other server
+ * instance (0 .. LOOKUP_PEERS-1, default the number of instances, so
+ * use a PERSIST server with more instances to get more peers) and
+ * sends each one LOOKUP_RPCS (default 10) ready RPCs, timing the first
+ * one (which pays for the connection) apart from the rest.  in each
+ * later round it looks up every peer again, both through mercury and
+ * through the instance's address cache (a hash table of looked up
+ * addresses keyed by address string).  the instances wait for each
+ * other to finish before they start sending.  main prints histograms
+ * of the cold, repeated, and cached lookups and of the first and later
+ * RPCs, and the speedup of the cache.  setenv "ADDRCACHE" to have MESH look
+ * up its servers through the cache as well (the addresses looked up by
+ * LOOKUP are then reused).  LOOKUP does not work with SHAREDCLASS (all
+ * the instances there share one address).
+ *
+ * normally client instance n only sends to server instance n.  setenv
+ * "MESH" to have every client instance send to every server instance
+ * (all-to-all): each instance looks up all the server addresses (and
+ * registers all their RPC names) at startup and picks the target of
+ * each RPC with "MESH=rr" (round robin, starting at its own server),
+ * "MESH=random", or "MESH=hash" (the server is a hash of a per-RPC key,
+ * so the spread is the same on every run).  control RPCs still only go
+ * to the instance's own server, and we don't send the done RPCs until
+ * every instance has finished sending.  each phase also reports the
+ * RPC count, ops/sec, and latency of each client->server pair, and main
+ * prints a matrix of the per-pair ops/sec.
+ *
+ * setenv "BATCH" to a number of messages to batch small messages.  the
+ * instance then makes logical messages of INSIZE bytes (COUNT is the
+ * number of messages and RATE is messages per second) and packs them
+ * into a batch buffer for their target (its server, or the server
+ * picked by MESH).  a batch is sent as one RPC when it holds BATCH
+ * messages, or when its oldest message has waited "BATCH_FLUSH" usec
+ * (default 1000), and the server unpacks it and counts each message.
+ * WINDOW limits the batch RPCs in flight (an unlimited window is capped
+ * at count/BATCH of them).  each phase also reports the messages/sec,
+ * the average messages per RPC, and a histogram of each message's
+ * latency from when it was made (or scheduled) to when the reply to
+ * its batch came in.  BATCH can be a list (e.g. "1-64") to sweep the
+ * batch size, in which case main prints a table of the message rate
+ * and latency of each phase.  BATCH does not work with BULK.
+ *
+ * the instances normally run as threads of one process.  setenv "FORK"
+ * to run each instance in its own child process instead (so they share
+ * no locks in mercury or NA).  the instances' results are gathered in a
+ * shared memory segment and main prints the same aggregate report.
+ * comparing a run with and without FORK shows whether scaling is
+ * limited by in-process locking or by the network.  the server can be
+ * run with FORK too.  FORK does not work with SHAREDCLASS.
+ *
+ * several clients can share one server if it runs with PERSIST (see
+ * sndrcv-srvr.cc).  to run more than one client on a host, setenv
+ * "LOCALPORT" to give each its own local ports (the default is the
+ * port after the last server port).  setenv "SHUTDOWN" on the last
+ * client to have it send the server a shutdown RPC ("s%d") after its
+ * done RPCs, which stops a PERSIST server.
  *
  * note: the number of instances between the client and server
- * should match.
+ * should match (a PERSIST server may have more).
  *
  * usage: ./sndrcv-client n-instances local-addr-spec remote-addr-spec
  *
@@ -35,18 +240,44 @@
 
 #include <assert.h>
 #include <err.h>
+#include <errno.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <pthread.h>
 #include <time.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
 
 #include <mercury.h>
 #include <mercury_macros.h>
 
+#include "sndrcv-rpc.h"
+#include "sndrcv-util.h"
+
 #define BASEPORT 19900   /* starting TCP port we contact (instance 0) */
 #define DEF_COUNT 5      /* default number of msgs to send and recv in a run */
 #define TIMEOUT 120      /* set alarm time (seconds) */
+#define READY_WAIT 1     /* seconds to wait for a reply to a ready RPC */
+#define MAX_BACKOFF 1000000  /* max usec to wait between startup retries */
+#define DEF_INTERVAL 1   /* default secs between interval reports (DURATION) */
+#define KNEE_TPUT 0.95   /* knee: min fraction of the offered rate achieved */
+#define KNEE_LAT 2       /* knee: max p99 growth over the lowest rate */
+#define SPIN_NS 50000    /* open loop: spin (not sleep) this close to a send */
+#define DEF_BATCH_FLUSH 1000  /* default max usec a message waits in a batch */
+#define STEADY_SLICES 5  /* steady state: number of slices that must agree */
+#define DEF_STEADY_SLICE 100  /* default msec per steady state slice */
+#define DEF_LF_SPIN 50   /* default usec a LOCKFREE sender polls, then sleeps */
+#define DEF_LOOKUP_RPCS 10  /* default ready RPCs sent to each LOOKUP peer */
+#define ACACHE_MIN 16    /* initial number of address cache slots */
+
+#define MESH_NONE   0    /* instance n only sends to server n (default) */
+#define MESH_RR     1    /* mesh: round robin over all servers */
+#define MESH_RANDOM 2    /* mesh: pick a server at random */
+#define MESH_HASH   3    /* mesh: server is a hash of the RPC's key */
 
 /*
  * g: shared global data
@@ -55,11 +286,162 @@ struct g {
     int ninst;               /* from the cmd line */
     char *localspec;         /* from the cmd line */
     char *remotespec;        /* from the cmd line */
-    int count;               /* number of msgs to send in a run */
-    int serialsend;          /* use serial send mode */
+    int count;               /* number of msgs to send in a phase */
+    int duration;            /* secs to send in a phase (0=use count) */
+    int interval;            /* secs between interval reports (0=off) */
+    struct phase *phases;    /* array of phases to run (sweep) */
+    int nphases;             /* number of phases */
+    int bulkop;              /* bulk mode (BULKOP_PULL/PUSH), 0=off */
+    int poisson;             /* open loop: poisson (vs fixed) arrivals */
+    int mesh;                /* MESH_* */
+    int ntargets;            /* servers each instance sends to */
+    uint64_t batchflush;     /* max nsec a message waits in a batch */
+    int warmup;              /* RPCs to send before measuring a phase */
+    int warmsecs;            /* ... or secs to send them for (0=use warmup) */
+    double steady;           /* stop at steady state (tolerance %, 0=off) */
+    uint64_t steadyslice;    /* nsec per steady state slice */
+    uint64_t lfspin;         /* nsec a LOCKFREE sender polls before sleeping */
+    int bidir;               /* serve reverse RPCs from the server */
+    int lookup;              /* LOOKUP benchmark rounds (0=off) */
+    int lookuppeers;         /* server instances to look up */
+    int lookuprpcs;          /* ready RPCs to send each peer */
+    int addrcache;           /* look up MESH servers through the cache */
+    struct progress_policy prog;  /* how network threads call progress */
+    struct affinity_plan aff;     /* where to pin our threads */
+    int shared;              /* all instances share one class */
+    hg_class_t *hgclass;     /* the shared class (shared mode only) */
+    pthread_mutex_t reglock; /* serializes RPC registration in shared mode */
+    pthread_barrier_t *readybar; /* instances wait here until all ready */
+    int fork;                /* run each instance in its own process */
     int quiet;               /* don't print during transfer */
+    int localport;           /* port for our first instance */
+    int shutdown;            /* send the server a shutdown RPC at the end */
+    FILE *results;           /* results file (NULL=none) */
+    const char *tag;         /* label for result records */
+    char transport[64];      /* transport name (for result records) */
+    struct peertab *peers;   /* server addresses (sndrcv-loop only) */
 } g;
 
+/*
+ * phase: the parameters for one measurement phase of a run.  we
+ * normally only have one phase, but a sweep runs several in order.
+ */
+struct phase {
+    int window;              /* max # of RPCs in flight (0=unlimited) */
+    int insz;                /* request payload size */
+    int outsz;               /* reply payload size */
+    int bulksz;              /* bulk transfer size (bulk mode only) */
+    int rate;                /* open loop RPCs/sec (0=closed loop) */
+    int batch;               /* max messages per RPC (0=no batching) */
+    int zcopy;               /* use the zero-copy procs ("z%d" RPC) */
+    int pool;                /* reuse handles from a pool (vs create) */
+    int lockfree;            /* lock-free completion accounting */
+    int inprog;              /* sender drives progress (no network thread) */
+};
+
+/*
+ * result: the results of one instance running one phase
+ */
+struct result {
+    uint64_t nrpcs;          /* number of RPCs sent */
+    uint64_t *pairrpcs;      /* RPCs sent to each target (MESH only) */
+    uint64_t nsec;           /* wall time to send nrpcs RPCs */
+    uint64_t cpu;            /* cpu time used by instance's threads */
+    uint64_t maxlag;         /* open loop: latest send vs. schedule (nsec) */
+    struct hist lat;         /* per-RPC latency histogram */
+    uint64_t nmsgs;          /* number of messages sent (BATCH only) */
+    struct hist msglat;      /* per-message latency (BATCH only) */
+    uint64_t warmrpcs;       /* RPCs sent in the warm-up (not counted) */
+    uint64_t warmns;         /* time the warm-up took */
+    uint64_t steadyns;       /* time to steady state (0=not reached) */
+    uint64_t nrev;           /* reverse RPCs served (BIDIR only) */
+};
+
+/*
+ * sndreq: per-RPC request state, passed as the arg to forw_cb().
+ * we preallocate one of these for each RPC that can be in flight
+ * before we start the clock, so that the send path doesn't malloc.
+ * the sender takes a free one before each send and release_reqs() puts
+ * it back once forw_cb() has run, so waiting for a free sndreq is how
+ * we wait for the window.
+ */
+struct sndreq {
+    int n;                   /* instance number that owns the request */
+    uint64_t start;          /* time HG_Forward was called (nsec), or the
+                                time it was scheduled for in open loop */
+    hg_handle_t hand;        /* pooled handle (HANDLEPOOL only) */
+    int t;                   /* target the request (or hand) is for */
+    int nmsgs;               /* number of messages in it (BATCH only) */
+    uint64_t *stamps;        /* time each message was made (BATCH only) */
+};
+
+/*
+ * batch: the messages an instance has waiting to go to one target as
+ * a single RPC (BATCH only).  HG_Forward() encodes the RPC's input
+ * before it returns, so the buffer can be refilled as soon as the
+ * batch is sent.  the stamps are copied to the batch's sndreq.
+ */
+struct batch {
+    char *buf;               /* packed messages (length + data each) */
+    int len;                 /* bytes used in buf */
+    int nmsgs;               /* number of messages in buf */
+    uint64_t *stamps;        /* time each message was made */
+};
+
+/*
+ * steady: the throughput of the last few slices of a phase, to see if
+ * it has settled (STEADY only)
+ */
+struct steady {
+    uint64_t start;          /* time the current slice started */
+    uint64_t nsent;          /* RPCs completed when it started */
+    double rate[STEADY_SLICES];  /* ops/sec of the last slices (a ring) */
+    int nslices;             /* number of slices so far */
+};
+
+/*
+ * target: a server instance that an instance sends RPCs to.  we have
+ * just one (server n) unless we are in MESH mode.
+ */
+struct target {
+    int m;                   /* server instance number */
+    hg_addr_t addr;          /* its address */
+    int ownaddr;             /* we looked up addr (so we free it) */
+    hg_id_t rpcid;           /* its RPC ID ("f%d") */
+    hg_id_t zid;             /* its zero-copy RPC ID ("z%d") */
+    hg_id_t bulkid;          /* its bulk RPC ID ("b%d") */
+};
+
+/*
+ * acache: an instance's address cache.  looked up addresses are kept
+ * in an open addressing hash table (linear probing) keyed by their
+ * address string.  the table is a power of 2 in size and we double it
+ * when it gets half full.  the cache owns the addresses in it.
+ */
+struct acache_ent {
+    char *id;                /* address string (malloc'd, NULL=empty) */
+    hg_addr_t addr;          /* its looked up address */
+};
+
+struct acache {
+    struct acache_ent *ents; /* array of size slots */
+    int size;                /* number of slots (0 or a power of 2) */
+    int nents;               /* number of slots in use */
+};
+
+/*
+ * lookupstats: an instance's LOOKUP benchmark results
+ */
+struct lookupstats {
+    int npeers;              /* number of peers looked up */
+    uint64_t nsec;           /* wall time of the benchmark */
+    struct hist cold;        /* first lookup of each peer */
+    struct hist again;       /* later lookups through mercury */
+    struct hist cached;      /* later lookups through the cache */
+    struct hist first;       /* first RPC to each peer */
+    struct hist later;       /* the rest of the RPCs to each peer */
+};
+
 /*
  * is: per-instance state structure.   we malloc an array of these at
  * startup.
@@ -69,48 +451,168 @@ struct is {
     hg_class_t *hgclass;     /* class for this instance */
     hg_context_t *hgctx;     /* context for this instance */
     hg_id_t myrpcid;         /* the ID of the instance's RPC */
+    hg_id_t myzid;           /* the ID of the instance's zero-copy RPC */
+    hg_id_t mybulkid;        /* the ID of the instance's bulk RPC */
+    hg_id_t myreadyid;       /* the ID of the instance's ready RPC */
+    hg_id_t mydoneid;        /* the ID of the instance's done RPC */
+    hg_id_t myshutid;        /* the ID of the instance's shutdown RPC */
+    hg_id_t myrevid;         /* the ID of the server's reverse RPC to us */
     pthread_t sthread;       /* server thread */
     char myid[256];          /* my local merc address */
     char remoteid[256];      /* remote merc address */
     hg_addr_t remoteaddr;    /* encoded remote address */
     char myfun[64];          /* my function name */
+    char myzfun[64];         /* my zero-copy function name */
+    char mybulkfun[64];      /* my bulk function name */
+    char myreadyfun[64];     /* my ready function name */
+    char mydonefun[64];      /* my done function name */
+    char myshutfun[64];      /* my shutdown function name */
+    char myrevfun[64];       /* my reverse function name */
+    int origin;              /* our origin number (from the server) */
+    uint64_t readyns;        /* time it took to get ready to send */
+    struct acache ac;        /* looked up addresses (LOOKUP/ADDRCACHE) */
+    struct lookupstats *lk;  /* LOOKUP benchmark results */
+    char *sendbuf;           /* request payload (sized for largest phase) */
+    char *bulkbuf;           /* bulk buffer (sized for largest phase) */
+    hg_bulk_t bulkhand;      /* bulk handle for bulkbuf */
+    char *revbuf;            /* reverse reply payload (BIDIR) */
+    int revbufsz;            /* size of revbuf */
+    uint64_t nrev;           /* reverse RPCs served (atomic) */
 
-    /* sending count stuff (nsent) */
+    /*
+     * sending count stuff (nsent).  in a LOCKFREE phase the mutex does
+     * not protect nissued, nsent, the free reqs, or swaiting: they are
+     * updated with atomics, the free reqs are on freeq, and the sender
+     * sleeps on the swake futex instead of scond.
+     */
     pthread_mutex_t slock;   /* nsent lock */
     pthread_cond_t scond;    /* nsent cond var */
-    int nsent;               /* number succesfully sent - mutex protects */
+    pthread_cond_t ncond;    /* network thread parks on this (INLINE) */
+    int netpark;             /* network thread should park - mutex protects */
+    int netparked;           /* network thread is parked - mutex protects */
+    uint64_t nissued;        /* number of RPCs forwarded - mutex protects */
+    uint64_t nsent;          /* number succesfully sent - mutex protects */
+    struct workq freeq;      /* free reqs (LOCKFREE only) */
+    uint32_t swake;          /* futex the sender sleeps on (LOCKFREE only) */
+    int curphase;            /* current phase number */
+    struct sndreq *reqs;     /* array of nreqs request structures */
+    int nreqs;               /* max # of RPCs in flight in this phase */
+    struct sndreq **freereqs;  /* stack of free reqs - mutex protects */
+    int nfree;               /* number of free reqs - mutex protects */
+    struct sndreq **donereqs;  /* completed, not yet freed (see forw_cb) */
+    int ndone;               /* number of donereqs - trigger thread only */
+    int swaiting;            /* sender waiting on scond - mutex protects */
+    int inphase;             /* set while a phase is running - mutex protects */
+    uint64_t phstart;        /* time the current phase started */
+    unsigned short xsubi[3]; /* random state for poisson arrivals */
 
     /* no mutex since only the main thread can write it */
     int sends_done;          /* set to non-zero when nsent is done */
+
+    /* only used by the sender during a phase */
+    struct batch *bat;       /* batch for each target (BATCH only) */
+    uint64_t *stampbuf;      /* the reqs' stamp arrays (BATCH only) */
+
+    /* only written by the network thread (via forw_cb) during a phase */
+    struct hist *lat;        /* latency histogram of the current phase */
+    struct hist *msglat;     /* message latency hist of the current phase */
+    struct hist ivlat;       /* latency histogram of the current interval */
+    uint64_t ivstart;        /* time the current interval started */
+
+    struct result *res;      /* array of per-phase results */
+    struct target *tgt;      /* array of g.ntargets targets */
+    int home;                /* index of server n in tgt */
+    uint64_t seq;            /* key of the next RPC (MESH=hash) */
+    struct hist *pairlat;    /* latency to each target (MESH only) */
 };
 struct is *is;    /* an array of state */
 
 /*
- * lookup_state: for looking up an address
+ * lookup_state: for looking up an address (also used to wait for the
+ * reply to a ready RPC)
  */
 struct lookup_state {
     pthread_mutex_t lock;    /* protect state */
     int n;                   /* instance number that owns lookup */
     int done;                /* set non-zero if done */
+    int ret;                 /* reply value (control RPCs) */
+    hg_addr_t addr;          /* looked up address */
     pthread_cond_t lkupcond; /* caller waits on this */
 };
 
-/*
- * input and output structures (this also generates XDR fns using boost pp)
- */
-MERCURY_GEN_PROC(rpcin_t, ((int32_t)(ret)))
-MERCURY_GEN_PROC(rpcout_t, ((int32_t)(ret)))
-
 /*
  * forward prototypes here, so we can structure the source code to
  * be more linear to make it easier to read.
  */
 static void *run_instance(void *arg);   /* run one instance */
+static void run_phase(int n, int pno);  /* run one phase of an instance */
+static uint64_t send_rpcs(int n, int pno, int count, int secs,
+                          int steady);  /* send a phase's RPCs */
+static int steady_check(int n, struct steady *sp, uint64_t now);
+static void wait_reqs(int n);           /* wait for RPCs in flight */
+static void phase_reset(int n, int pno);  /* zero a phase's stats */
+static void phase_name(int pno, char *buf, int len);  /* describe phase */
+static double phase_mbs(int pno, double ops,
+                        double mops);   /* MB/s of data moved */
+static void create_handle(int n, int t, hg_handle_t *hp);  /* new hand */
+static hg_id_t target_rpcid(int n, struct target *tp);  /* RPC to send */
+static hg_handle_t req_handle(int n, struct sndreq *rq,
+                              int t);   /* handle for rq to target t */
+static void target_handle(int n, int t, hg_handle_t hand);  /* aim hand */
+static int pick_target(int n);          /* target for the next RPC */
+static void setup_targets(int n);       /* fill in is[n].tgt */
+static void mesh_report(int pno);       /* print per pair ops/sec matrix */
 static void *run_network(void *arg);    /* per-instance network thread */
 static hg_return_t lookup_cb(const struct hg_cb_info *cbi);  /* client cb */
 static hg_return_t forw_cb(const struct hg_cb_info *cbi);  /* client cb */
+static hg_return_t ready_cb(const struct hg_cb_info *cbi);  /* client cb */
+static hg_return_t revhandler(hg_handle_t handle);  /* BIDIR server cb */
+static hg_return_t rev_sent_cb(const struct hg_cb_info *cbi);  /* BIDIR */
+static hg_addr_t lookup_remote(int n, const char *id);  /* w/retry */
+static int lookup_addr(int n, const char *id,
+                       hg_addr_t *addrp);  /* one lookup (no retry) */
+static void wait_ready(int n);          /* wait for server to be ready */
+static int call_ctl(int n, hg_id_t id, int wait,
+                    int *retp);         /* send a control RPC */
+static int ctl_rpc(int n, hg_addr_t addr, int m, hg_id_t id, int wait,
+                   int *retp);          /* ... to any server */
+static void peer_id(int m, char *buf, int len);  /* server m's address */
+static hg_addr_t addr_get(int n, const char *id,
+                          int *ownp);   /* lookup (ADDRCACHE: cached) */
+static hg_addr_t acache_get(struct acache *ac, const char *id);
+static void acache_put(struct acache *ac, const char *id, hg_addr_t addr);
+static void acache_free(int n, struct acache *ac);  /* free all addrs */
+static void lookup_bench(int n);        /* LOOKUP benchmark */
+static void lookup_report(void);        /* LOOKUP results of all instances */
+static struct sndreq *get_req(int n);   /* get a free sndreq (wait) */
+static int lf_ready(int n, int all, struct sndreq **rqp);  /* LOCKFREE */
+static void lf_wait(int n, int all, struct sndreq **rqp);  /* LOCKFREE */
+static void lf_wake(int n);             /* wake LOCKFREE sender */
+static void release_reqs(int n);        /* free completed reqs */
+static uint64_t get_nsent(int n);       /* RPCs completed so far */
+static int find_twin(int pno, int pool, int lockfree,
+                     int inprog);       /* match phase */
+static void batch_add(int n, int t, uint64_t made);  /* add a message */
+static void batch_send(int n, int t);   /* send target t's batch */
+static int batch_due(int n, uint64_t when);  /* batch to flush by when */
+static void interval_report(int n);     /* print interval stats if due */
+static void wait_until(int n, uint64_t when);  /* wait for "when" (nsec) */
+static void net_park(int n, int park);  /* park/unpark network thread */
+static void inline_wait(int n, int all);  /* drive progress until ready */
+static int inline_poll(int n, int block);  /* trigger, then progress */
+static void phase_record(int pno, int instance, uint64_t nrpcs,
+                         uint64_t nmsgs, uint64_t nsec, uint64_t cpu,
+                         const struct hist *lat,
+                         const struct hist *msglat);  /* write results */
+static int rate_group(int a, int b);    /* phases in same rate sweep? */
+static void knee_report(double *ops, double *mops,
+                        uint64_t *p99);  /* rate sweep knee */
+static void batch_report(double *ops, double *mops, uint64_t *p50,
+                         uint64_t *p99);  /* BATCH message rate table */
+static void zcopy_report(double *ops, uint64_t *cpurpc,
+                         uint64_t *p50);  /* ZEROCOPY vs generated procs */
 
-/* fake server call back, we are not a server so shouldn't happen */
+/* fake server call back for the RPCs we send, so shouldn't happen */
 static hg_return_t rpchandler(hg_handle_t handle) {
     errx(1, "rpchandler called on client?!?!");
 }
@@ -123,9 +625,19 @@ static hg_return_t rpchandler(hg_handle_t handle) {
  * the address specs use a %d for port (e.g. 'bmp+tcp://%d')
  */
 int main(int argc, char **argv) {
-    int lcv, rv;
+    int lcv, pno, rv, nwins, nins, nouts, nbulks, nrates, nbatches, nzcopies;
+    int npools, nlfs, ninls, w, i, o, b, t, k, z, h, f, e;
     pthread_t *tarr;
-    char *c;
+    pid_t *pids;
+    size_t shmsz;
+    char *c, *cp, pname[128];
+    uint64_t *wins, *ins, *outs, *bulks, *rates, *batches, *zcopies, *pools;
+    uint64_t *lfs, *inls;
+    uint64_t nrpcs, cpu;
+    uint64_t *p50s, *p99s, *mp50s, *mp99s, *cpurpcs, maxns, rdy, nmsgs;
+    struct hist *all, *msgall;
+    struct phase *p;
+    double ops, mops, rev, *rpcns, *opss, *mopss;
     if (argc != 4) 
         errx(0, "usage: %s n-instances local-addr-spec remote-addr-spec\n", 
                *argv);
@@ -139,19 +651,241 @@ int main(int argc, char **argv) {
     } else {
         g.count = DEF_COUNT;
     }
-    g.serialsend = (getenv("SERIALSEND") != NULL);
+    if ((c = getenv("DURATION")) != NULL && (rv = atoi(c)) > 0)
+        g.duration = rv;
+    if ((c = getenv("WARMUP")) != NULL) {
+        rv = strtol(c, &cp, 0);
+        if (rv < 0 || cp == c || (*cp && strcmp(cp, "s") != 0))
+            errx(1, "WARMUP must be a number of RPCs or secs (e.g. 2s)");
+        if (*cp)
+            g.warmsecs = rv;
+        else
+            g.warmup = rv;
+    }
+    if ((c = getenv("STEADY")) != NULL)
+        g.steady = atof(c);
+    if ((c = getenv("STEADY_SLICE")) != NULL && (rv = atoi(c)) > 0)
+        g.steadyslice = (uint64_t)rv * 1000000;
+    else
+        g.steadyslice = (uint64_t)DEF_STEADY_SLICE * 1000000;
+    if ((c = getenv("INTERVAL")) != NULL)
+        g.interval = atoi(c);
+    else if (g.duration)
+        g.interval = DEF_INTERVAL;
+    if ((c = getenv("LOCALPORT")) != NULL)
+        g.localport = atoi(c);
+    else
+        g.localport = g.ninst + BASEPORT;
+    g.shutdown = (getenv("SHUTDOWN") != NULL);
+    if ((c = getenv("MESH")) != NULL) {
+        if (strcmp(c, "rr") == 0)
+            g.mesh = MESH_RR;
+        else if (strcmp(c, "random") == 0)
+            g.mesh = MESH_RANDOM;
+        else if (strcmp(c, "hash") == 0)
+            g.mesh = MESH_HASH;
+        else
+            errx(1, "MESH must be set to 'rr', 'random', or 'hash'");
+    }
+    g.ntargets = (g.mesh) ? g.ninst : 1;
+    nwins = parse_list(getenv("WINDOW") ? getenv("WINDOW") :
+                       (getenv("SERIALSEND") ? "1" : "0"), &wins);
+    if ((c = getenv("BULK")) != NULL) {
+        if (strcmp(c, "pull") == 0)
+            g.bulkop = BULKOP_PULL;
+        else if (strcmp(c, "push") == 0)
+            g.bulkop = BULKOP_PUSH;
+        else
+            errx(1, "BULK must be set to 'pull' or 'push'");
+        nbulks = parse_list(getenv("BULKSIZE") ? getenv("BULKSIZE") : "64k",
+                            &bulks);
+    } else {
+        nbulks = parse_list("0", &bulks);
+    }
+    if (g.bulkop) {                        /* payloads not used */
+        nins = parse_list("0", &ins);
+        nouts = parse_list("0", &outs);
+    } else if ((c = getenv("SIZE")) != NULL) {  /* symmetric size sweep */
+        nins = parse_list(c, &ins);
+        nouts = 1;           /* outsize follows insize */
+        outs = NULL;
+    } else {
+        nins = parse_list(getenv("INSIZE") ? getenv("INSIZE") : "0", &ins);
+        nouts = parse_list(getenv("OUTSIZE") ? getenv("OUTSIZE") : "0",
+                           &outs);
+    }
+    nrates = parse_list(getenv("RATE") ? getenv("RATE") : "0", &rates);
+    if ((c = getenv("ARRIVAL")) != NULL) {
+        if (strcmp(c, "poisson") == 0)
+            g.poisson = 1;
+        else if (strcmp(c, "fixed") != 0)
+            errx(1, "ARRIVAL must be set to 'fixed' or 'poisson'");
+    }
+    nbatches = parse_list(getenv("BATCH") ? getenv("BATCH") : "0", &batches);
+    if (g.bulkop && (nbatches > 1 || batches[0] != 0))
+        errx(1, "BATCH does not work with BULK");
+    if ((c = getenv("BATCH_FLUSH")) != NULL)
+        g.batchflush = (uint64_t)atoi(c) * 1000;
+    else
+        g.batchflush = (uint64_t)DEF_BATCH_FLUSH * 1000;
+    nzcopies = parse_list(getenv("ZEROCOPY") ? getenv("ZEROCOPY") : "0",
+                          &zcopies);
+    if (g.bulkop && (nzcopies > 1 || zcopies[0] != 0))
+        errx(1, "ZEROCOPY does not work with BULK");
+    npools = parse_list(getenv("HANDLEPOOL") ? getenv("HANDLEPOOL") : "0",
+                        &pools);
+    nlfs = parse_list(getenv("LOCKFREE") ? getenv("LOCKFREE") : "0", &lfs);
+    ninls = parse_list(getenv("INLINE") ? getenv("INLINE") : "0", &inls);
+    if ((c = getenv("LOCKFREE_SPIN")) != NULL)
+        g.lfspin = (uint64_t)atoi(c) * 1000;
+    else
+        g.lfspin = (uint64_t)DEF_LF_SPIN * 1000;
+    g.bidir = (getenv("BIDIR") != NULL);
+    if ((c = getenv("LOOKUP")) != NULL)
+        g.lookup = atoi(c);
+    if ((c = getenv("LOOKUP_PEERS")) != NULL && (rv = atoi(c)) > 0)
+        g.lookuppeers = rv;
+    else
+        g.lookuppeers = g.ninst;
+    if ((c = getenv("LOOKUP_RPCS")) != NULL && (rv = atoi(c)) > 0)
+        g.lookuprpcs = rv;
+    else
+        g.lookuprpcs = DEF_LOOKUP_RPCS;
+    g.addrcache = (getenv("ADDRCACHE") != NULL);
+
+    /*
+     * build the list of phases: every combination of the above.  we
+     * count through them like digits of a number, with the window
+     * changing the slowest and the inline progress setting the fastest.
+     */
+    g.nphases = nwins * nins * nouts * nbulks * nrates * nbatches *
+                nzcopies * npools * nlfs * ninls;
+    g.phases = (struct phase *)malloc(g.nphases * sizeof(*g.phases));
+    if (!g.phases) errx(1, "malloc phases failed");
+    for (pno = 0 ; pno < g.nphases ; pno++) {
+        lcv = pno;
+        e = lcv % ninls;     lcv /= ninls;
+        f = lcv % nlfs;      lcv /= nlfs;
+        h = lcv % npools;    lcv /= npools;
+        z = lcv % nzcopies;  lcv /= nzcopies;
+        k = lcv % nbatches;  lcv /= nbatches;
+        t = lcv % nrates;    lcv /= nrates;
+        b = lcv % nbulks;    lcv /= nbulks;
+        o = lcv % nouts;     lcv /= nouts;
+        i = lcv % nins;      lcv /= nins;
+        w = lcv;
+        g.phases[pno].window = wins[w];
+        g.phases[pno].insz = ins[i];
+        g.phases[pno].outsz = (outs) ? outs[o] : ins[i];
+        g.phases[pno].bulksz = bulks[b];
+        g.phases[pno].rate = rates[t];
+        g.phases[pno].batch = batches[k];
+        g.phases[pno].zcopy = (zcopies[z] != 0);
+        g.phases[pno].pool = (pools[h] != 0);
+        g.phases[pno].lockfree = (lfs[f] != 0);
+        g.phases[pno].inprog = (inls[e] != 0);
+    }
+    free(wins);
+    free(ins);
+    free(outs);
+    free(bulks);
+    free(rates);
+    free(batches);
+    free(zcopies);
+    free(pools);
+    free(lfs);
+    free(inls);
+    progress_parse(getenv("PROGRESS"), &g.prog);
+    affinity_parse(getenv("AFFINITY"), g.ninst, &g.aff);
+    g.shared = (getenv("SHAREDCLASS") != NULL);
+    g.fork = (getenv("FORK") != NULL);
+    if (g.fork && (g.shared || g.peers))
+        errx(1, "FORK does not work with SHAREDCLASS or in sndrcv-loop");
+    if (g.lookup && g.shared)
+        errx(1, "LOOKUP does not work with SHAREDCLASS");
+    if (g.lookup && g.lookuppeers < 2)
+        errx(1, "LOOKUP needs more than one server (set LOOKUP_PEERS)");
+    if (g.lookup && g.peers && g.lookuppeers > g.peers->n)
+        errx(1, "LOOKUP_PEERS is more than the %d servers", g.peers->n);
     g.quiet = (getenv("QUIET") != NULL);
+    g.results = results_open(getenv("RESULTS"));
+    g.tag = getenv("RESULTS_TAG");
+    transport_name(g.remotespec, g.transport, sizeof(g.transport));
+    if (g.duration || g.warmsecs)   /* give long runs time to finish */
+        alarm(TIMEOUT + g.nphases * (g.duration + g.warmsecs));
 
-    printf("main: starting %d ...\n", g.ninst);
+    printf("main: starting %d ... (progress=%s, %s class, affinity=%s)\n",
+           g.ninst, progress_name(&g.prog), (g.fork) ? "per-process" :
+           ((g.shared) ? "shared" : "per-instance"), affinity_name(&g.aff));
+    if (g.duration)
+        printf("main: %d phases of %d sec each, interval=%d sec\n",
+               g.nphases, g.duration, g.interval);
+    if (g.warmup || g.warmsecs)
+        printf("main: each phase starts with a warm-up of %d %s (not "
+               "counted)\n", (g.warmsecs) ? g.warmsecs : g.warmup,
+               (g.warmsecs) ? "sec" : "rpcs");
+    if (g.steady > 0)
+        printf("main: phases stop at steady state (%d slices of %d msec "
+               "within %.1f%%)\n", STEADY_SLICES,
+               (int)(g.steadyslice / 1000000), g.steady);
+    if (g.mesh)
+        printf("main: mesh mode (%s), each instance sends to %d servers\n",
+               (g.mesh == MESH_RR) ? "rr" : (g.mesh == MESH_RANDOM) ?
+               "random" : "hash", g.ntargets);
+    for (pno = 0 ; pno < g.nphases && !g.phases[pno].batch ; pno++)
+        /* find a batch phase */ ;
+    if (pno < g.nphases)
+        printf("main: batching messages, flush after %llu usec\n",
+               (unsigned long long)(g.batchflush / 1000));
+    if (g.lookup)
+        printf("main: lookup benchmark: %d rounds over %d servers, %d rpcs "
+               "each\n", g.lookup, g.lookuppeers, g.lookuprpcs);
+    if (g.addrcache)
+        printf("main: mesh addresses are looked up through the cache\n");
+    if (g.bidir)
+        printf("main: bidirectional, serving the server's reverse rpcs\n");
     tarr = (pthread_t *)malloc(g.ninst * sizeof(pthread_t));
-    if (!tarr) errx(1, "malloc tarr failed");
-    is = (struct is *)malloc(g.ninst *sizeof(*is));    /* array */
-    if (!is) errx(1, "malloc is failed");
-    memset(is, 0, g.ninst * sizeof(*is));
+    pids = (pid_t *)malloc(g.ninst * sizeof(pid_t));
+    if (!tarr || !pids) errx(1, "malloc tarr failed");
+    if (g.fork) {   /* room for is, the results, and readybar (+slop) */
+        shmsz = g.ninst * (sizeof(*is) + g.nphases * (sizeof(struct result) +
+                g.ntargets * sizeof(uint64_t) + 128) + 128 +
+                ((g.lookup) ? sizeof(struct lookupstats) + 128 : 0)) + 4096;
+        shm_init(shmsz);
+        printf("main: each instance runs in its own process (%zu byte "
+               "shared segment)\n", shmsz);
+    }
+    is = (struct is *)shm_alloc(g.ninst * sizeof(*is));    /* array */
+
+    if (g.shared) {   /* one class for everyone */
+        char myid[256];
+        snprintf(myid, sizeof(myid), g.localspec, g.localport);
+        printf("main: attempt to init shared class %s\n", myid);
+        g.hgclass = HG_Init(myid, HG_FALSE);
+        if (g.hgclass == NULL)  errx(1, "HG_init failed");
+        if (pthread_mutex_init(&g.reglock, NULL) != 0)
+            errx(1, "reglock init");
+    }
+
+    g.readybar = (pthread_barrier_t *)shm_alloc(sizeof(*g.readybar));
+    if (g.fork) {    /* the barrier is shared by the instance processes */
+        pthread_barrierattr_t ba;
+        if (pthread_barrierattr_init(&ba) != 0 ||
+            pthread_barrierattr_setpshared(&ba, PTHREAD_PROCESS_SHARED) != 0 ||
+            pthread_barrier_init(g.readybar, &ba, g.ninst) != 0)
+            errx(1, "readybar init");
+        pthread_barrierattr_destroy(&ba);
+    } else if (pthread_barrier_init(g.readybar, NULL, g.ninst) != 0) {
+        errx(1, "readybar init");
+    }
 
-    /* fork off a thread for each instance */
+    /* fork off a thread (or a process) for each instance */
     for (lcv = 0 ; lcv < g.ninst ; lcv++) {
         is[lcv].n = lcv;
+        if (g.fork) {
+            pids[lcv] = fork_instance(run_instance, (void*)&is[lcv]);
+            continue;
+        }
         rv = pthread_create(&tarr[lcv], NULL, run_instance, (void*)&is[lcv]);
         if (rv != 0) {
             printf("pthread create failed %d\n", rv);
@@ -161,12 +895,131 @@ int main(int argc, char **argv) {
 
     /* now wait for everything to finish */
     printf("main: collecting\n");
-    for (lcv = 0 ; lcv < g.ninst ; lcv++) {
-        pthread_join(tarr[lcv], NULL);
+    if (g.fork) {
+        if ((rv = wait_instances(pids, g.ninst)) != 0)
+            errx(1, "%d instance processes failed", rv);
+    } else {
+        for (lcv = 0 ; lcv < g.ninst ; lcv++) {
+            pthread_join(tarr[lcv], NULL);
+        }
     }
     printf("main: collection done\n");
+    pthread_barrier_destroy(g.readybar);
+
+    for (rdy = 0, lcv = 0 ; lcv < g.ninst ; lcv++) {
+        if (is[lcv].readyns > rdy) rdy = is[lcv].readyns;
+    }
+    printf("main: time to ready (slowest instance) = %.3f msec\n", rdy / 1e6);
+    if (g.lookup) lookup_report();
+
+    /* merge the per-instance results for each phase */
+    all = (struct hist *)malloc(sizeof(*all));
+    msgall = (struct hist *)malloc(sizeof(*msgall));
+    opss = (double *)malloc(g.nphases * sizeof(*opss));
+    mopss = (double *)malloc(g.nphases * sizeof(*mopss));
+    p50s = (uint64_t *)malloc(g.nphases * sizeof(*p50s));
+    p99s = (uint64_t *)malloc(g.nphases * sizeof(*p99s));
+    cpurpcs = (uint64_t *)malloc(g.nphases * sizeof(*cpurpcs));
+    rpcns = (double *)malloc(g.nphases * sizeof(*rpcns));
+    mp50s = (uint64_t *)malloc(g.nphases * sizeof(*mp50s));
+    mp99s = (uint64_t *)malloc(g.nphases * sizeof(*mp99s));
+    if (!all || !msgall || !opss || !mopss || !p50s || !p99s || !cpurpcs ||
+        !rpcns || !mp50s || !mp99s)
+        errx(1, "malloc phase results failed");
+    for (pno = 0 ; pno < g.nphases ; pno++) {
+        hist_reset(all);
+        hist_reset(msgall);
+        ops = mops = rpcns[pno] = 0;
+        for (nrpcs = nmsgs = cpu = maxns = 0, lcv = 0 ; lcv < g.ninst ;
+             lcv++) {
+            hist_merge(all, &is[lcv].res[pno].lat);
+            hist_merge(msgall, &is[lcv].res[pno].msglat);
+            ops += is[lcv].res[pno].nrpcs * 1e9 / is[lcv].res[pno].nsec;
+            mops += is[lcv].res[pno].nmsgs * 1e9 / is[lcv].res[pno].nsec;
+            rpcns[pno] += (double)is[lcv].res[pno].nsec /
+                          is[lcv].res[pno].nrpcs;
+            nrpcs += is[lcv].res[pno].nrpcs;
+            nmsgs += is[lcv].res[pno].nmsgs;
+            cpu += is[lcv].res[pno].cpu;
+            if (is[lcv].res[pno].nsec > maxns) maxns = is[lcv].res[pno].nsec;
+        }
+        rpcns[pno] /= g.ninst;    /* average time per rpc of an instance */
+        phase_name(pno, pname, sizeof(pname));
+        printf("main: %s: all instances ops/sec = %.1f, MB/s = %.3f, "
+               "cpu nsec/rpc = %llu\n", pname, ops,
+               phase_mbs(pno, ops, mops),
+               (unsigned long long)(cpu / nrpcs));
+        hist_print("main", "all instances rpc latency", all);
+        if (g.bidir) {
+            for (rev = 0, lcv = 0 ; lcv < g.ninst ; lcv++)
+                rev += is[lcv].res[pno].nrev * 1e9 / is[lcv].res[pno].nsec;
+            printf("main: %s: all instances reverse ops/sec = %.1f (%.1f%% "
+                   "of forward)\n", pname, rev, 100.0 * rev / ops);
+        }
+        if (g.phases[pno].batch) {
+            printf("main: %s: all instances msgs/sec = %.1f, msgs/rpc = "
+                   "%.1f\n", pname, mops, (double)nmsgs / nrpcs);
+            hist_print("main", "all instances message latency", msgall);
+        }
+        opss[pno] = ops;
+        mopss[pno] = mops;
+        p50s[pno] = hist_pct(all, 50.0);
+        p99s[pno] = hist_pct(all, 99.0);
+        cpurpcs[pno] = cpu / nrpcs;
+        mp50s[pno] = hist_pct(msgall, 50.0);
+        mp99s[pno] = hist_pct(msgall, 99.0);
+        phase_record(pno, -1, nrpcs, nmsgs, maxns, cpu, all, msgall);
+        if (g.mesh) mesh_report(pno);
+
+        /* pool and lock-free phases come after the phase they improve */
+        p = &g.phases[pno];
+        if (p->pool && (k = find_twin(pno, 0, p->lockfree, p->inprog)) >= 0) {
+            printf("main: %s: handle pool saves %.1f nsec per rpc (%.1f%%)\n",
+                   pname, rpcns[k] - rpcns[pno],
+                   100.0 * (rpcns[k] - rpcns[pno]) / rpcns[k]);
+        }
+        if (p->lockfree &&
+            (k = find_twin(pno, p->pool, 0, p->inprog)) >= 0) {
+            printf("main: %s: lock-free completion saves %.1f nsec per rpc "
+                   "(%.1f%%), cpu nsec/rpc %llu -> %llu\n", pname,
+                   rpcns[k] - rpcns[pno],
+                   100.0 * (rpcns[k] - rpcns[pno]) / rpcns[k],
+                   (unsigned long long)cpurpcs[k],
+                   (unsigned long long)cpurpcs[pno]);
+        }
+        if (p->inprog &&
+            (k = find_twin(pno, p->pool, p->lockfree, 0)) >= 0) {
+            printf("main: %s: inline progress saves %.1f nsec per rpc "
+                   "(%.1f%%), cpu nsec/rpc %llu -> %llu, p50 %llu -> %llu "
+                   "nsec, p99 %llu -> %llu nsec\n", pname,
+                   rpcns[k] - rpcns[pno],
+                   100.0 * (rpcns[k] - rpcns[pno]) / rpcns[k],
+                   (unsigned long long)cpurpcs[k],
+                   (unsigned long long)cpurpcs[pno],
+                   (unsigned long long)p50s[k], (unsigned long long)p50s[pno],
+                   (unsigned long long)p99s[k], (unsigned long long)p99s[pno]);
+        }
+    }
+    knee_report(opss, mopss, p99s);
+    batch_report(opss, mopss, mp50s, mp99s);
+    zcopy_report(opss, cpurpcs, p50s);
+    free(all);
+    free(msgall);
+    free(opss);
+    free(mopss);
+    free(p50s);
+    free(p99s);
+    free(cpurpcs);
+    free(rpcns);
+    free(mp50s);
+    free(mp99s);
+    if (g.results) fclose(g.results);
+    if (g.shared) {
+        HG_Finalize(g.hgclass);
+        pthread_mutex_destroy(&g.reglock);
+    }
     
-    exit(0);
+    return(0);
 }
 
 /*
@@ -178,221 +1031,1880 @@ void *run_instance(void *arg) {
     int n = isp->n;               /* recover n from isp */
     int lcv, rv;
     hg_return_t ret;
-    struct lookup_state lst;
-    hg_op_id_t lookupop;
-    struct timespec start, end;
-    uint64_t diff;
+    uint64_t t0;
     
+    t0 = now_ns();
+    affinity_pin(g.aff.app[n]);
     printf("%d: instance running\n", n);
+    if (g.aff.mode != AFF_NONE)
+        printf("%d: affinity %s: app thread on cpu %d, network thread on "
+               "cpu %d\n", n, affinity_name(&g.aff), g.aff.app[n],
+               g.aff.net[n]);
     is[n].n = n;
+    is[n].xsubi[0] = n;       /* seed poisson arrivals (per instance) */
+    is[n].xsubi[1] = getpid();
+    is[n].xsubi[2] = t0;
 
-    /* use a different port for local so we don't walk on server */
-    snprintf(is[n].myid, sizeof(is[n].myid), g.localspec, g.ninst+n+BASEPORT);
-    snprintf(is[n].remoteid, sizeof(is[n].remoteid), g.remotespec, n+BASEPORT);
-    printf("%d: attempt to init %s\n", n, is[n].myid);
-    is[n].hgclass = HG_Init(is[n].myid, HG_FALSE);
-    if (is[n].hgclass == NULL)  errx(1, "HG_init failed");
-    is[n].hgctx = HG_Context_create(is[n].hgclass);
-    if (is[n].hgctx == NULL)  errx(1, "HG_Context_create failed");
+    if (g.shared) {
+        /* shared class: server has one port, our context id picks target */
+        snprintf(is[n].myid, sizeof(is[n].myid), g.localspec,
+                 g.localport);
+        if (g.peers)
+            peertab_wait(g.peers, 0, is[n].remoteid, sizeof(is[n].remoteid));
+        else
+            snprintf(is[n].remoteid, sizeof(is[n].remoteid), g.remotespec,
+                     BASEPORT);
+        printf("%d: using shared class, context id %d\n", n, n);
+        is[n].hgclass = g.hgclass;
+        is[n].hgctx = HG_Context_create_id(is[n].hgclass, n);
+        if (is[n].hgctx == NULL)  errx(1, "HG_Context_create_id failed");
+        pthread_mutex_lock(&g.reglock);
+    } else {
+        /* use a different port for local so we don't walk on server */
+        snprintf(is[n].myid, sizeof(is[n].myid), g.localspec,
+                 g.localport + n);
+        if (g.peers)
+            peertab_wait(g.peers, n, is[n].remoteid, sizeof(is[n].remoteid));
+        else
+            snprintf(is[n].remoteid, sizeof(is[n].remoteid), g.remotespec,
+                     n+BASEPORT);
+        printf("%d: attempt to init %s\n", n, is[n].myid);
+        is[n].hgclass = HG_Init(is[n].myid, HG_FALSE);
+        if (is[n].hgclass == NULL)  errx(1, "HG_init failed");
+        is[n].hgctx = HG_Context_create(is[n].hgclass);
+        if (is[n].hgctx == NULL)  errx(1, "HG_Context_create failed");
+    }
     
     /* XXX: how else can we cvt myfun string to hg_id_t ? */
     snprintf(is[n].myfun, sizeof(is[n].myfun), "f%d", n);
     is[n].myrpcid = HG_Register_name(is[n].hgclass, is[n].myfun, 
                                      hg_proc_rpcin_t, hg_proc_rpcout_t, 
                                      rpchandler);
+    snprintf(is[n].myzfun, sizeof(is[n].myzfun), "z%d", n);
+    is[n].myzid = HG_Register_name(is[n].hgclass, is[n].myzfun,
+                                   hg_proc_rpcin_z, hg_proc_rpcout_z,
+                                   rpchandler);
+    snprintf(is[n].mybulkfun, sizeof(is[n].mybulkfun), "b%d", n);
+    is[n].mybulkid = HG_Register_name(is[n].hgclass, is[n].mybulkfun,
+                                      hg_proc_bulkin_t, hg_proc_bulkout_t,
+                                      rpchandler);
+    snprintf(is[n].myreadyfun, sizeof(is[n].myreadyfun), "r%d", n);
+    is[n].myreadyid = HG_Register_name(is[n].hgclass, is[n].myreadyfun,
+                                       hg_proc_ready_t, hg_proc_ready_t,
+                                       rpchandler);
+    snprintf(is[n].mydonefun, sizeof(is[n].mydonefun), "d%d", n);
+    is[n].mydoneid = HG_Register_name(is[n].hgclass, is[n].mydonefun,
+                                      hg_proc_ready_t, hg_proc_ready_t,
+                                      rpchandler);
+    snprintf(is[n].myshutfun, sizeof(is[n].myshutfun), "s%d", n);
+    is[n].myshutid = HG_Register_name(is[n].hgclass, is[n].myshutfun,
+                                      hg_proc_ready_t, hg_proc_ready_t,
+                                      rpchandler);
+    if (g.bidir) {   /* the server's RPCs to us (registered data is n) */
+        snprintf(is[n].myrevfun, sizeof(is[n].myrevfun), "v%d", n);
+        is[n].myrevid = HG_Register_name(is[n].hgclass, is[n].myrevfun,
+                                         hg_proc_rpcin_t, hg_proc_rpcout_t,
+                                         revhandler);
+        if (HG_Register_data(is[n].hgclass, is[n].myrevid, &is[n].n,
+                             NULL) != HG_SUCCESS)
+            errx(1, "unable to register n as reverse data");
+        for (rv = 1, lcv = 0 ; lcv < g.nphases ; lcv++) {
+            if (g.phases[lcv].outsz > rv) rv = g.phases[lcv].outsz;
+        }
+        is[n].revbuf = (char *)malloc(rv);
+        if (!is[n].revbuf) errx(1, "malloc revbuf failed");
+        memset(is[n].revbuf, 'v', rv);
+        is[n].revbufsz = rv;
+    }
+    if (g.shared) pthread_mutex_unlock(&g.reglock);
 
-    /* fork off a progress/trigger thread */
+    /* fork off a progress/trigger thread (it uses the lock and conds) */
+    if (pthread_mutex_init(&is[n].slock, NULL) != 0) errx(1, "s mutex init");
+    if (pthread_cond_init(&is[n].scond, NULL) != 0) errx(1, "scond init");
+    if (pthread_cond_init(&is[n].ncond, NULL) != 0) errx(1, "ncond init");
+    is[n].ivstart = now_ns();   /* no interval report before a phase */
     is[n].sends_done = 0;   /* run_network reads this */
     rv = pthread_create(&is[n].sthread, NULL, run_network, (void*)&n);
     if (rv != 0) errx(1, "pthread create srvr failed");
 
-    /* poor man's barrier, since we don't want to deal with MPI */
-    printf("%d: init done.  sleeping 10\n", n);
-    sleep(10);
-
     /* 
      * resolve the remote address ... only need to do this once, since
      * it is fixed for this program...
      */
-    printf("%d: remote address lookup %s\n", n, is[n].remoteid);
-    if (pthread_mutex_init(&lst.lock, NULL) != 0) errx(1, "l mutex init");
-    pthread_mutex_lock(&lst.lock);
-    lst.n = n;
-    lst.done = 0;
-    if (pthread_cond_init(&lst.lkupcond, NULL) != 0) errx(1, "cond init?");
+    is[n].remoteaddr = lookup_remote(n, is[n].remoteid);
 
-    ret = HG_Addr_lookup(is[n].hgctx, lookup_cb, &lst, 
-                         is[n].remoteid, &lookupop);
-    if (ret != HG_SUCCESS) errx(1, "HG addr lookup launch failed");
-    while (lst.done == 0) {
-        if (pthread_cond_wait(&lst.lkupcond, &lst.lock) != 0) 
-            errx(1, "lk cond wait");
+    /* make sure the server is answering before we start */
+    wait_ready(n);
+    is[n].readyns = now_ns() - t0;
+    printf("%d: server ready, time to ready = %.3f msec\n", n,
+           is[n].readyns / 1e6);
+
+    /* wait for all our instances to be ready, then start together */
+    rv = pthread_barrier_wait(g.readybar);
+    if (rv != 0 && rv != PTHREAD_BARRIER_SERIAL_THREAD)
+        errx(1, "readybar wait");
+    if (g.lookup) {   /* don't let a done RPC stop a server still in use */
+        lookup_bench(n);
+        rv = pthread_barrier_wait(g.readybar);
+        if (rv != 0 && rv != PTHREAD_BARRIER_SERIAL_THREAD)
+            errx(1, "readybar wait");
     }
-    if (lst.done < 0) errx(1, "lookup failed");
-    pthread_cond_destroy(&lst.lkupcond);
-    pthread_mutex_unlock(&lst.lock);
-    pthread_mutex_destroy(&lst.lock);
-    printf("%d: done remote address lookup\n", n);
-   
-    /* poor man's barrier, since we don't want to deal with MPI */
-    printf("%d: address lookup done.  sleeping 10 again\n", n);
-    sleep(10);
+    setup_targets(n);     /* (mesh+shared needs the others' RPC IDs) */
 
     printf("%d: sending...\n", n);
-    if (pthread_mutex_init(&is[n].slock, NULL) != 0) errx(1, "s mutex init");
-    is[n].nsent = 0;
-    if (pthread_cond_init(&is[n].scond, NULL) != 0) errx(1, "scond init");
-
-    /* start the clock before initiating sends */
-    clock_gettime(CLOCK_MONOTONIC, &start);
-
-    for (lcv = 0 ; lcv < g.count ; lcv++) {
-        hg_handle_t rpchand;
-        rpcin_t in;
-        ret = HG_Create(is[n].hgctx, is[n].remoteaddr,
-                        is[n].myrpcid, &rpchand);
-        if (ret != HG_SUCCESS) errx(1, "hg create failed");
-
-        in.ret = (lcv+1);
-
-        if (!g.quiet) printf("%d: launching %d\n", n, in.ret);
-        ret = HG_Forward(rpchand, forw_cb, &n, &in);
-        if (ret != HG_SUCCESS) errx(1, "hg forward failed");
-        if (!g.quiet) printf("%d: launched %d\n", n, in.ret);
-        if (g.serialsend) {  /* sending one at a time, don't overlap */
-            pthread_mutex_lock(&is[n].slock);
-            while (is[n].nsent <= lcv) {
-                if (pthread_cond_wait(&is[n].scond, &is[n].slock) != 0)
-                    errx(1, "snd ser cond wait");
-            }
-            pthread_mutex_unlock(&is[n].slock);
+    /* main reads the results (shared memory with FORK) */
+    is[n].res = (struct result *)shm_alloc(g.nphases * sizeof(*is[n].res));
+    for (rv = 1, lcv = 0 ; lcv < g.nphases ; lcv++) {
+        if (g.phases[lcv].insz > rv) rv = g.phases[lcv].insz;
+    }
+    is[n].sendbuf = (char *)malloc(rv);
+    if (!is[n].sendbuf) errx(1, "malloc sendbuf failed");
+    memset(is[n].sendbuf, 'x', rv);
+    if (g.bulkop) {
+        hg_size_t bsz;
+        void *bp;
+        for (bsz = 1, lcv = 0 ; lcv < g.nphases ; lcv++) {
+            if (g.phases[lcv].bulksz > (int)bsz) bsz = g.phases[lcv].bulksz;
         }
+        is[n].bulkbuf = (char *)malloc(bsz);
+        if (!is[n].bulkbuf) errx(1, "malloc bulkbuf failed");
+        memset(is[n].bulkbuf, 'b', bsz);
+        bp = is[n].bulkbuf;
+        ret = HG_Bulk_create(is[n].hgclass, 1, &bp, &bsz,
+                             (g.bulkop == BULKOP_PULL) ? HG_BULK_READ_ONLY :
+                             HG_BULK_WRITE_ONLY, &is[n].bulkhand);
+        if (ret != HG_SUCCESS) errx(1, "HG_Bulk_create failed");
     }
 
-    /* wait until all sends are complete (already done if serialsend) */
-    pthread_mutex_lock(&is[n].slock);
-    while (is[n].nsent < g.count) {
-        if (pthread_cond_wait(&is[n].scond, &is[n].slock) != 0)
-            errx(1, "snd cond wait");
+    for (lcv = 0 ; lcv < g.nphases ; lcv++) {
+        run_phase(n, lcv);
     }
 
-    /* stop the clock now that all sends completed */
-    clock_gettime(CLOCK_MONOTONIC, &end);
-
-    /* print out rpc stats */
-    diff = 1e9 * (end.tv_sec - start.tv_sec) + end.tv_nsec - start.tv_nsec;
-    printf("%d: average time per rpc = %lu nsec\n", n, diff / g.count);
-
     pthread_cond_destroy(&is[n].scond);
-    pthread_mutex_unlock(&is[n].slock);
+    pthread_cond_destroy(&is[n].ncond);
     pthread_mutex_destroy(&is[n].slock);
-    is[n].sends_done = 1;    /* tells network thread to exit */
     printf("%d: all sends complete\n", n);
+
+    /* tell the server we are done so it can exit */
+    if (g.mesh) {   /* other instances may still be sending to our server */
+        rv = pthread_barrier_wait(g.readybar);
+        if (rv != 0 && rv != PTHREAD_BARRIER_SERIAL_THREAD)
+            errx(1, "readybar wait");
+    }
+    if (call_ctl(n, is[n].mydoneid, 0, NULL) < 0)
+        warnx("%d: done RPC failed", n);
+
+    /* once all our instances are done, instance 0 can stop the server */
+    if (g.shutdown) {
+        rv = pthread_barrier_wait(g.readybar);
+        if (rv != 0 && rv != PTHREAD_BARRIER_SERIAL_THREAD)
+            errx(1, "readybar wait");
+        if (n == 0 && call_ctl(n, is[n].myshutid, READY_WAIT, NULL) < 0)
+            warnx("%d: shutdown RPC failed", n);
+    }
+    is[n].sends_done = 1;    /* tells network thread to exit */
     
     /* done sending, wait for server to finish and exit */
     pthread_join(is[n].sthread, NULL);
+    for (lcv = 0 ; lcv < g.ntargets ; lcv++) {
+        if (is[n].tgt[lcv].ownaddr)
+            HG_Addr_free(is[n].hgclass, is[n].tgt[lcv].addr);
+    }
+    free(is[n].tgt);
+    is[n].tgt = NULL;
+    free(is[n].pairlat);
+    is[n].pairlat = NULL;
+    acache_free(n, &is[n].ac);
     if (is[n].remoteaddr) {
         HG_Addr_free(is[n].hgclass, is[n].remoteaddr);
         is[n].remoteaddr = NULL;
     }
     printf("%d: all recvs complete\n", n);
+    free(is[n].sendbuf);
+    is[n].sendbuf = NULL;
+    free(is[n].revbuf);
+    is[n].revbuf = NULL;
+    if (is[n].bulkhand) {
+        HG_Bulk_free(is[n].bulkhand);
+        is[n].bulkhand = HG_BULK_NULL;
+    }
+    free(is[n].bulkbuf);
+    is[n].bulkbuf = NULL;
     HG_Context_destroy(is[n].hgctx);
-    HG_Finalize(is[n].hgclass);
+    if (!g.shared) HG_Finalize(is[n].hgclass);
     printf("%d: instance done\n", n);
 }
 
 /*
- * lookup_cb: this gets called when HG_Addr_lookup() completes.
- * we need to stash the results and wake the caller.
+ * lookup_remote: lookup the address "id" of a server of instance n and
+ * return it.  if the lookup fails we retry with exponential backoff.
  */
-static hg_return_t lookup_cb(const struct hg_cb_info *cbi) {
-    struct lookup_state *lstp = (struct lookup_state *)cbi->arg;
-    int n;
+static hg_addr_t lookup_remote(int n, const char *id) {
+    hg_addr_t addr;
+    int backoff;
 
-#if 0  
-    /* 
-     * XXX: bug, hg_core_trigger_lookup_entry() sets it to HG_CB_BULK
-     * instead of HG_CB_LOOKUP.  bug.  jerome fixed feb 2, 2017
-     */
-    if (cbi->type != HG_CB_LOOKUP) 
-        errx(1, "lookup_cb mismatch %d", cbi->type);
-#endif
+    printf("%d: remote address lookup %s\n", n, id);
+    for (backoff = 1000 ; lookup_addr(n, id, &addr) < 0 ; backoff *= 2) {
+        if (backoff > MAX_BACKOFF) backoff = MAX_BACKOFF;
+        printf("%d: lookup failed, retry in %d usec\n", n, backoff);
+        usleep(backoff);
+    }
+    printf("%d: done remote address lookup\n", n);
+    return(addr);
+}
 
-    pthread_mutex_lock(&lstp->lock);
-    if (cbi->ret != HG_SUCCESS) {
-        warnx("lookup_cb failed %d\n", cbi->ret);
-        lstp->done = -1;
-    } else {
-        n = lstp->n;
-        is[n].remoteaddr = cbi->info.lookup.addr;
-        lstp->done = 1;
+/*
+ * lookup_addr: lookup the address "id" once for instance n and wait
+ * for the answer.  returns 1 and puts the address in *addrp if the
+ * lookup worked, -1 otherwise.
+ */
+static int lookup_addr(int n, const char *id, hg_addr_t *addrp) {
+    struct lookup_state lst;
+    hg_op_id_t lookupop;
+    hg_return_t ret;
+
+    if (pthread_mutex_init(&lst.lock, NULL) != 0) errx(1, "l mutex init");
+    pthread_mutex_lock(&lst.lock);
+    lst.n = n;
+    if (pthread_cond_init(&lst.lkupcond, NULL) != 0) errx(1, "cond init?");
+
+    lst.done = 0;
+    ret = HG_Addr_lookup(is[n].hgctx, lookup_cb, &lst, id, &lookupop);
+    if (ret != HG_SUCCESS) errx(1, "HG addr lookup launch failed");
+    while (lst.done == 0) {
+        if (pthread_cond_wait(&lst.lkupcond, &lst.lock) != 0) 
+            errx(1, "lk cond wait");
     }
-    pthread_mutex_unlock(&lstp->lock);
-    pthread_cond_signal(&lstp->lkupcond);
+    if (lst.done > 0)
+        *addrp = lst.addr;
 
-    return(HG_SUCCESS);
+    pthread_cond_destroy(&lst.lkupcond);
+    pthread_mutex_unlock(&lst.lock);
+    pthread_mutex_destroy(&lst.lock);
+    return(lst.done);
 }
 
 /*
- * forw_cb: this gets called on the client side when HG_Forward() completes
- * (i.e. when we get the reply from the remote side).
+ * wait_ready: ping instance n's server with a ready RPC until it
+ * answers (with our origin number).  if a ping fails or is not
+ * answered within READY_WAIT seconds we retry with exponential backoff.
  */
-static hg_return_t forw_cb(const struct hg_cb_info *cbi) {
-    int *np = (int *)cbi->arg;
-    int n;
+static void wait_ready(int n) {
+    int backoff;
+
+    for (backoff = 1000 ;
+         call_ctl(n, is[n].myreadyid, READY_WAIT, &is[n].origin) < 0 ;
+         backoff *= 2) {
+        if (backoff > MAX_BACKOFF) backoff = MAX_BACKOFF;
+        printf("%d: server not ready, retry in %d usec\n", n, backoff);
+        usleep(backoff);
+    }
+}
+
+/*
+ * call_ctl: send a control RPC (ready, done, or shutdown) to instance
+ * n's server and wait for the reply.  if "wait" is non-zero and the
+ * reply does not come within that many seconds, we cancel the RPC.
+ * returns 1 if the server answered (and puts its reply value in *retp
+ * if retp isn't NULL), -1 otherwise.
+ */
+static int call_ctl(int n, hg_id_t id, int wait, int *retp) {
+    return(ctl_rpc(n, is[n].remoteaddr, n, id, wait, retp));
+}
+
+/*
+ * ctl_rpc: call_ctl() for instance n to server instance m at "addr"
+ * (the LOOKUP benchmark sends ready RPCs to other servers)
+ */
+static int ctl_rpc(int n, hg_addr_t addr, int m, hg_id_t id, int wait,
+                   int *retp) {
+    struct lookup_state rst;
+    struct timespec abstime;
     hg_handle_t hand;
     hg_return_t ret;
-    rpcout_t out;
+    ready_t in;
+    int rv;
 
-    n = *np;
-    if (cbi->ret != HG_SUCCESS) errx(1, "forw_cb failed");
-    if (cbi->type != HG_CB_FORWARD) errx(1, "forw_cb wrong type");
-    hand = cbi->info.forward.handle;
+    if (pthread_mutex_init(&rst.lock, NULL) != 0) errx(1, "r mutex init");
+    pthread_mutex_lock(&rst.lock);
+    rst.n = n;
+    if (pthread_cond_init(&rst.lkupcond, NULL) != 0) errx(1, "cond init?");
+
+    ret = HG_Create(is[n].hgctx, addr, id, &hand);
+    if (ret != HG_SUCCESS) errx(1, "hg create ctl failed");
+    if (g.shared && HG_Set_target_id(hand, m) != HG_SUCCESS)
+        errx(1, "hg set target id failed");
+
+    rst.done = 0;
+    in.ret = n;
+    ret = HG_Forward(hand, ready_cb, &rst, &in);
+    if (ret != HG_SUCCESS) {
+        rst.done = -1;
+    } else {
+        clock_gettime(CLOCK_REALTIME, &abstime);
+        abstime.tv_sec += wait;
+        while (rst.done == 0) {
+            if (wait) {
+                rv = pthread_cond_timedwait(&rst.lkupcond, &rst.lock,
+                                            &abstime);
+                if (rv == ETIMEDOUT) break;
+            } else {
+                rv = pthread_cond_wait(&rst.lkupcond, &rst.lock);
+            }
+            if (rv != 0) errx(1, "ctl cond wait");
+        }
+        if (rst.done == 0) {   /* timed out: cancel and wait for cb */
+            HG_Cancel(hand);
+            while (rst.done == 0) {
+                if (pthread_cond_wait(&rst.lkupcond, &rst.lock) != 0)
+                    errx(1, "ctl cancel cond wait");
+            }
+        }
+    }
+    HG_Destroy(hand);
+    if (rst.done > 0 && retp)
+        *retp = rst.ret;
+
+    pthread_cond_destroy(&rst.lkupcond);
+    pthread_mutex_unlock(&rst.lock);
+    pthread_mutex_destroy(&rst.lock);
+    return(rst.done);
+}
+
+/*
+ * run_phase: send "count" RPCs (or send RPCs for "duration" seconds)
+ * to the server using the parameters of phase "pno" and record the
+ * results in is[n].res[pno].
+ */
+static void run_phase(int n, int pno) {
+    struct phase *p = &g.phases[pno];
+    struct result *r = &is[n].res[pno];
+    int lcv, t;
+    struct timespec start, end;
+    uint64_t diff, cpu0, t0, rev0;
+    double ops, mops;
+    char tag[128];
 
-    ret = HG_Get_output(hand, &out);
-    if (ret != HG_SUCCESS) errx(1, "get output failed");
+    is[n].curphase = pno;
+    is[n].lat = &r->lat;
+    is[n].msglat = &r->msglat;
+    if (g.mesh) {
+        r->pairrpcs = (uint64_t *)shm_alloc(g.ntargets * sizeof(uint64_t));
+    } else {
+        r->pairrpcs = NULL;
+    }
+    phase_reset(n, pno);
 
-    if (!g.quiet) printf("%d: forw complete (code=%d)\n", n, out.ret);
+    /* one request (and pooled handle) for every RPC that can be in flight */
+    if (p->window)
+        is[n].nreqs = p->window;
+    else if (p->batch)
+        is[n].nreqs = (g.count + p->batch - 1) / p->batch;
+    else
+        is[n].nreqs = g.count;
+    is[n].reqs = (struct sndreq *)malloc(is[n].nreqs * sizeof(*is[n].reqs));
+    is[n].freereqs = (struct sndreq **)malloc(is[n].nreqs *
+                                              sizeof(*is[n].freereqs));
+    is[n].donereqs = (struct sndreq **)malloc(is[n].nreqs *
+                                              sizeof(*is[n].donereqs));
+    if (!is[n].reqs || !is[n].freereqs || !is[n].donereqs)
+        errx(1, "malloc reqs failed");
+    is[n].ndone = 0;
+    if (p->batch) {   /* stamps for each req, and a batch for each target */
+        is[n].stampbuf = (uint64_t *)malloc(is[n].nreqs * p->batch *
+                                            sizeof(uint64_t));
+        is[n].bat = (struct batch *)malloc(g.ntargets * sizeof(*is[n].bat));
+        if (!is[n].stampbuf || !is[n].bat) errx(1, "malloc batch failed");
+        for (t = 0 ; t < g.ntargets ; t++) {
+            is[n].bat[t].buf = (char *)malloc(p->batch *
+                                              (BATCH_HDR + p->insz));
+            is[n].bat[t].stamps = (uint64_t *)malloc(p->batch *
+                                                     sizeof(uint64_t));
+            if (!is[n].bat[t].buf || !is[n].bat[t].stamps)
+                errx(1, "malloc batch failed");
+            is[n].bat[t].len = is[n].bat[t].nmsgs = 0;
+        }
+    }
+    for (lcv = 0 ; lcv < is[n].nreqs ; lcv++) {
+        is[n].reqs[lcv].n = n;
+        is[n].reqs[lcv].hand = NULL;
+        is[n].reqs[lcv].t = is[n].home;
+        is[n].reqs[lcv].nmsgs = 0;
+        is[n].reqs[lcv].stamps = (p->batch) ?
+                                 &is[n].stampbuf[lcv * p->batch] : NULL;
+        if (p->pool) create_handle(n, is[n].home, &is[n].reqs[lcv].hand);
+        is[n].freereqs[lcv] = &is[n].reqs[lcv];
+    }
+    is[n].nfree = is[n].nreqs;
+    if (p->lockfree) {   /* the free reqs go on the queue instead */
+        workq_init(&is[n].freeq, is[n].nreqs);
+        for (lcv = 0 ; lcv < is[n].nreqs ; lcv++) {
+            if (workq_push(&is[n].freeq, &is[n].reqs[lcv]) != 0)
+                errx(1, "freeq push failed");
+        }
+    }
 
-    HG_Free_output(hand, &out);
+    if (p->inprog)       /* we drive progress ourselves in this phase */
+        net_park(n, 1);
 
-    if (HG_Destroy(hand) != HG_SUCCESS) errx(1, "forw_cb destroy hand");
+    /* warm up with the phase's traffic, then throw away its stats */
+    if (g.warmup || g.warmsecs) {
+        t0 = now_ns();
+        send_rpcs(n, pno, g.warmup, g.warmsecs, 0);
+        wait_reqs(n);
+        r->warmns = now_ns() - t0;
+        r->warmrpcs = is[n].nsent;
+        phase_reset(n, pno);
+    }
 
-    /* update records and see if we need to signal we are done */
+    /* start the clock before initiating sends */
+    cpu0 = thread_cpu_ns(pthread_self()) + thread_cpu_ns(is[n].sthread);
+    clock_gettime(CLOCK_MONOTONIC, &start);
     pthread_mutex_lock(&is[n].slock);
-    is[n].nsent++;
-    if (g.serialsend || is[n].nsent >= g.count)
-        pthread_cond_signal(&is[n].scond);
+    is[n].phstart = is[n].ivstart = now_ns();
+    hist_reset(&is[n].ivlat);
+    is[n].inphase = 1;        /* interval reports start now */
     pthread_mutex_unlock(&is[n].slock);
-    
-    return(HG_SUCCESS);
-}
+    rev0 = __atomic_load_n(&is[n].nrev, __ATOMIC_RELAXED);
 
-/*
- * run_network: network support pthread.   need to call progress to push the
- * network and then trigger to run the callback.  we do this all in 
- * one thread (meaning that we shouldn't block in the trigger function, 
- * or we won't make progress).  since we only have one thread running
- * trigger callback, we do not need to worry about concurrent access to
- * "got" ...
- */
-static void *run_network(void *arg) {
-    int n = *((int *)arg);
-    unsigned int actual; 
-    hg_return_t ret;
-    actual = 0;
+    r->steadyns = send_rpcs(n, pno, g.count, g.duration, (g.steady > 0));
 
+    /* wait until all sends are complete (all reqs are free again) */
+    wait_reqs(n);
+    pthread_mutex_lock(&is[n].slock);
+    is[n].inphase = 0;
+    r->nrpcs = is[n].nsent;
+    pthread_mutex_unlock(&is[n].slock);
+
+    /* stop the clock now that all sends completed */
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    r->nrev = __atomic_load_n(&is[n].nrev, __ATOMIC_RELAXED) - rev0;
+    r->cpu = thread_cpu_ns(pthread_self()) + thread_cpu_ns(is[n].sthread) -
+             cpu0;
+    if (p->inprog)
+        net_park(n, 0);
+
+    if (p->pool) {    /* all handles are back in the pool now */
+        for (lcv = 0 ; lcv < is[n].nreqs ; lcv++) {
+            HG_Destroy(is[n].reqs[lcv].hand);
+        }
+    }
+    if (p->lockfree)
+        workq_free(&is[n].freeq);
+    free(is[n].reqs);
+    free(is[n].freereqs);
+    free(is[n].donereqs);
+    is[n].reqs = NULL;
+    is[n].freereqs = NULL;
+    is[n].donereqs = NULL;
+    is[n].nreqs = is[n].nfree = 0;
+    if (p->batch) {
+        for (t = 0 ; t < g.ntargets ; t++) {
+            free(is[n].bat[t].buf);
+            free(is[n].bat[t].stamps);
+        }
+        free(is[n].bat);
+        free(is[n].stampbuf);
+        is[n].bat = NULL;
+        is[n].stampbuf = NULL;
+    }
+
+    /* print out rpc stats */
+    diff = 1e9 * (end.tv_sec - start.tv_sec) + end.tv_nsec - start.tv_nsec;
+    r->nsec = diff;
+    snprintf(tag, sizeof(tag), (g.nphases > 1) ? "%d " : "%d", n);
+    if (g.nphases > 1) {
+        phase_name(pno, tag + strlen(tag), sizeof(tag) - strlen(tag));
+    }
+    if (r->nrpcs == 0) errx(1, "%s: no RPCs sent?", tag);
+    ops = r->nrpcs * 1e9 / diff;
+    mops = r->nmsgs * 1e9 / diff;
+    printf("%s: %lu rpcs, average time per rpc = %lu nsec, ops/sec = %.1f, "
+           "MB/s = %.3f, cpu nsec/rpc = %lu\n", tag, r->nrpcs,
+           diff / r->nrpcs, ops, phase_mbs(pno, ops, mops),
+           r->cpu / r->nrpcs);
+    if (p->rate)
+        printf("%s: open loop target %s/sec = %d (%s), max send lag = "
+               "%llu nsec\n", tag, (p->batch) ? "msgs" : "ops", p->rate,
+               (g.poisson) ? "poisson" : "fixed",
+               (unsigned long long)r->maxlag);
+    if (g.warmup || g.warmsecs)
+        printf("%s: warm-up (not counted): %llu rpcs, average time per rpc "
+               "= %llu nsec\n", tag, (unsigned long long)r->warmrpcs,
+               (unsigned long long)((r->warmrpcs) ?
+                                    r->warmns / r->warmrpcs : 0));
+    if (g.steady > 0 && r->steadyns)
+        printf("%s: steady state after %.3f sec (last %d slices of %d msec "
+               "within %.1f%%)\n", tag, r->steadyns / 1e9, STEADY_SLICES,
+               (int)(g.steadyslice / 1000000), g.steady);
+    else if (g.steady > 0)
+        printf("%s: steady state not reached\n", tag);
+    hist_print(tag, "rpc latency", &r->lat);
+    if (g.bidir)
+        printf("%s: %llu reverse rpcs served, reverse ops/sec = %.1f\n",
+               tag, (unsigned long long)r->nrev, r->nrev * 1e9 / diff);
+    if (p->batch) {
+        printf("%s: %llu msgs, msgs/rpc = %.1f, msgs/sec = %.1f\n", tag,
+               (unsigned long long)r->nmsgs, (double)r->nmsgs / r->nrpcs,
+               mops);
+        hist_print(tag, "message latency", &r->msglat);
+    }
+    for (t = 0 ; g.mesh && t < g.ntargets ; t++) {
+        char what[64];
+        printf("%s: ->%d: %llu rpcs, ops/sec = %.1f\n", tag, t,
+               (unsigned long long)r->pairrpcs[t], r->pairrpcs[t] * 1e9 / diff);
+        snprintf(what, sizeof(what), "->%d rpc latency", t);
+        hist_print(tag, what, &is[n].pairlat[t]);
+    }
+    phase_record(pno, n, r->nrpcs, r->nmsgs, r->nsec, r->cpu, &r->lat,
+                 &r->msglat);
+}
+
+/*
+ * send_rpcs: send "count" RPCs (or send RPCs for "secs" seconds) to the
+ * server using the parameters of phase "pno", and don't wait for them
+ * to complete.  if "steady" is set we stop early once the throughput
+ * is steady (see steady_check()) and return how long that took (nsec),
+ * otherwise we return 0.  with BATCH, count is a number of messages.
+ */
+static uint64_t send_rpcs(int n, int pno, int count, int secs, int steady) {
+    struct phase *p = &g.phases[pno];
+    struct result *r = &is[n].res[pno];
+    struct steady st;
+    int lcv, t;
+    hg_return_t ret;
+    uint64_t t0, deadline, when, made, now, steadyns;
+    double sched;
+
+    t0 = now_ns();
+    steadyns = 0;
+    deadline = t0 + (uint64_t)secs * 1000000000ULL;
+    sched = 0;
+    when = 0;
+    if (steady) {
+        memset(&st, 0, sizeof(st));
+        st.start = t0;
+    }
+
+    for (lcv = 0 ; (secs) ? now_ns() < deadline : lcv < count ; lcv++) {
+        struct sndreq *rq;
+        hg_handle_t rpchand;
+        rpcin_t in;
+        bulkin_t bin;
+
+        if (steady && (now = now_ns()) - st.start >= g.steadyslice &&
+            steady_check(n, &st, now)) {
+            steadyns = now - t0;
+            break;
+        }
+        if (p->rate) {    /* open loop: the scheduled send time */
+            when = t0 + (uint64_t)sched;
+            sched += ((g.poisson) ? -log(1.0 - erand48(is[n].xsubi)) : 1.0) *
+                     1e9 / p->rate;
+        }
+        while (p->batch &&    /* send batches that time out before then */
+               (t = batch_due(n, (p->rate) ? when : now_ns())) >= 0) {
+            wait_until(n, is[n].bat[t].stamps[0] + g.batchflush);
+            batch_send(n, t);
+        }
+        if (p->rate)
+            wait_until(n, when);
+        t = (g.mesh) ? pick_target(n) : is[n].home;
+
+        if (p->batch) {   /* add a message to t's batch, send it if full */
+            made = now_ns();
+            if (p->rate) {
+                if (made - when > r->maxlag) r->maxlag = made - when;
+                made = when;
+            }
+            batch_add(n, t, made);
+            if (is[n].bat[t].nmsgs >= p->batch)
+                batch_send(n, t);
+            continue;
+        }
+        rq = get_req(n);      /* waits for the window to open */
+        rpchand = req_handle(n, rq, t);
+
+        if (!g.quiet) printf("%d: launching %d\n", n, lcv+1);
+        rq->start = now_ns();
+        if (p->rate) {    /* latency is measured from the scheduled time */
+            if (rq->start - when > r->maxlag) r->maxlag = rq->start - when;
+            rq->start = when;
+        }
+        if (g.bulkop) {
+            bin.ret = (lcv+1);
+            bin.origin = is[n].origin;
+            bin.op = g.bulkop;
+            bin.size = p->bulksz;
+            bin.bulk = is[n].bulkhand;
+            ret = HG_Forward(rpchand, forw_cb, rq, &bin);
+        } else {
+            in.ret = (lcv+1);
+            in.origin = is[n].origin;
+            in.outsz = p->outsz;
+            in.nmsgs = 0;
+            in.data.len = p->insz;
+            in.data.buf = is[n].sendbuf;
+            ret = HG_Forward(rpchand, forw_cb, rq, &in);
+        }
+        if (ret != HG_SUCCESS) errx(1, "hg forward failed");
+        if (!g.quiet) printf("%d: launched %d\n", n, lcv+1);
+        if (p->inprog)    /* run any callbacks that are ready */
+            inline_poll(n, 0);
+    }
+    for (t = 0 ; p->batch && t < g.ntargets ; t++) {   /* send the rest */
+        if (is[n].bat[t].nmsgs)
+            batch_send(n, t);
+    }
+    return(steadyns);
+}
+
+/*
+ * steady_check: called by send_rpcs() at the end of each STEADY_SLICE
+ * msec slice of a phase to record the slice's throughput.  returns 1 if
+ * the throughput of each of the last STEADY_SLICES slices was within
+ * STEADY percent of their average (i.e. the run has settled), else 0.
+ */
+static int steady_check(int n, struct steady *sp, uint64_t now) {
+    uint64_t nsent;
+    double lo, hi, avg;
+    int lcv;
+
+    nsent = get_nsent(n);
+    sp->rate[sp->nslices++ % STEADY_SLICES] = (nsent - sp->nsent) * 1e9 /
+                                              (now - sp->start);
+    sp->start = now;
+    sp->nsent = nsent;
+    if (sp->nslices < STEADY_SLICES)
+        return(0);
+
+    lo = hi = avg = sp->rate[0];
+    for (lcv = 1 ; lcv < STEADY_SLICES ; lcv++) {
+        if (sp->rate[lcv] < lo) lo = sp->rate[lcv];
+        if (sp->rate[lcv] > hi) hi = sp->rate[lcv];
+        avg += sp->rate[lcv];
+    }
+    avg /= STEADY_SLICES;
+    return(avg > 0 && hi - avg <= avg * g.steady / 100 &&
+           avg - lo <= avg * g.steady / 100);
+}
+
+/*
+ * wait_reqs: wait until all of instance n's RPCs in flight complete
+ * (i.e. all its reqs are free again)
+ */
+static void wait_reqs(int n) {
+    if (g.phases[is[n].curphase].inprog)
+        inline_wait(n, 1);
+    if (g.phases[is[n].curphase].lockfree) {
+        lf_wait(n, 1, NULL);
+        return;
+    }
+    pthread_mutex_lock(&is[n].slock);
+    while (is[n].nfree < is[n].nreqs) {
+        is[n].swaiting = 1;
+        if (pthread_cond_wait(&is[n].scond, &is[n].slock) != 0)
+            errx(1, "snd cond wait");
+    }
+    pthread_mutex_unlock(&is[n].slock);
+}
+
+/*
+ * phase_reset: zero instance n's counters and stats for phase pno (at
+ * the start of the phase, and again after its warm-up).  there must
+ * not be any RPCs in flight.
+ */
+static void phase_reset(int n, int pno) {
+    struct result *r = &is[n].res[pno];
+    int t;
+
+    pthread_mutex_lock(&is[n].slock);
+    is[n].nissued = is[n].nsent = 0;
+    pthread_mutex_unlock(&is[n].slock);
+    r->maxlag = 0;
+    r->nmsgs = 0;
+    hist_reset(&r->lat);
+    hist_reset(&r->msglat);
+    for (t = 0 ; g.mesh && t < g.ntargets ; t++) {
+        r->pairrpcs[t] = 0;
+        hist_reset(&is[n].pairlat[t]);
+    }
+}
+
+/*
+ * wait_until: wait until CLOCK_MONOTONIC time "when" (nsec).  we sleep
+ * until we are close and then spin, since sleeps tend to oversleep.
+ * in an INLINE phase instance n polls for progress until then instead.
+ */
+static void wait_until(int n, uint64_t when) {
+    struct timespec ts;
+    uint64_t now;
+
+    if (g.phases[is[n].curphase].inprog) {
+        while (now_ns() < when)
+            inline_poll(n, 0);
+        return;
+    }
+    now = now_ns();
+    if (when > now + SPIN_NS) {
+        ts.tv_sec = (when - SPIN_NS) / 1000000000ULL;
+        ts.tv_nsec = (when - SPIN_NS) % 1000000000ULL;
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts,
+                               NULL) == EINTR)
+            /* retry */ ;
+    }
+    while (now_ns() < when)
+        /* spin */ ;
+}
+
+/*
+ * get_req: get a free request structure for instance n, waiting for
+ * an RPC in flight to complete if there are none.
+ */
+static struct sndreq *get_req(int n) {
+    struct sndreq *rq;
+
+    if (g.phases[is[n].curphase].inprog)
+        inline_wait(n, 0);    /* then there is a free one */
+    if (g.phases[is[n].curphase].lockfree) {
+        lf_wait(n, 0, &rq);
+        /* only we change nissued, the store is for interval_report() */
+        __atomic_store_n(&is[n].nissued, is[n].nissued + 1, __ATOMIC_RELAXED);
+        return(rq);
+    }
+    pthread_mutex_lock(&is[n].slock);
+    while (is[n].nfree < 1) {
+        is[n].swaiting = 1;
+        if (pthread_cond_wait(&is[n].scond, &is[n].slock) != 0)
+            errx(1, "snd win cond wait");
+    }
+    rq = is[n].freereqs[--is[n].nfree];
+    is[n].nissued++;
+    pthread_mutex_unlock(&is[n].slock);
+
+    return(rq);
+}
+
+/*
+ * lf_ready: LOCKFREE check for get_req() and wait_reqs().  if "all" is
+ * set, return 1 if all of instance n's RPCs have completed.  otherwise
+ * try to take a free request and return 1 (with it in *rqp) if we got
+ * one.
+ */
+static int lf_ready(int n, int all, struct sndreq **rqp) {
+    if (all)
+        return(__atomic_load_n(&is[n].nsent, __ATOMIC_ACQUIRE) ==
+               is[n].nissued);
+    *rqp = (struct sndreq *)workq_pop(&is[n].freeq);
+    return(*rqp != NULL);
+}
+
+/*
+ * lf_wait: LOCKFREE wait until lf_ready() is true.  we poll for
+ * LOCKFREE_SPIN usec and then sleep on the swake futex.
+ */
+static void lf_wait(int n, int all, struct sndreq **rqp) {
+    uint64_t deadline;
+    uint32_t seq;
+
+    deadline = now_ns() + g.lfspin;
+    do {
+        if (lf_ready(n, all, rqp))
+            return;
+    } while (now_ns() < deadline);
+
+    /*
+     * we must say we are waiting before our last look, so that
+     * release_reqs() either sees us waiting or we see its completion.
+     * if it bumps swake after we read seq, the futex wait returns right
+     * away.
+     */
+    for (;;) {
+        seq = __atomic_load_n(&is[n].swake, __ATOMIC_ACQUIRE);
+        __atomic_store_n(&is[n].swaiting, 1, __ATOMIC_SEQ_CST);
+        if (lf_ready(n, all, rqp))
+            return;
+        if (syscall(SYS_futex, &is[n].swake, FUTEX_WAIT_PRIVATE, seq,
+                    NULL, NULL, 0) < 0 && errno != EAGAIN && errno != EINTR)
+            err(1, "futex wait");
+    }
+}
+
+/*
+ * lf_wake: wake instance n's sender if it is asleep in lf_wait()
+ */
+static void lf_wake(int n) {
+    if (__atomic_exchange_n(&is[n].swaiting, 0, __ATOMIC_SEQ_CST) == 0)
+        return;
+    __atomic_add_fetch(&is[n].swake, 1, __ATOMIC_RELEASE);
+    syscall(SYS_futex, &is[n].swake, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+/*
+ * get_nsent: return the number of instance n's RPCs that have completed
+ */
+static uint64_t get_nsent(int n) {
+    uint64_t nsent;
+
+    if (g.phases[is[n].curphase].lockfree)
+        return(__atomic_load_n(&is[n].nsent, __ATOMIC_ACQUIRE));
+    pthread_mutex_lock(&is[n].slock);
+    nsent = is[n].nsent;
+    pthread_mutex_unlock(&is[n].slock);
+    return(nsent);
+}
+
+/*
+ * net_park: park instance n's network thread (if park is set) so that
+ * the sender can drive progress itself (INLINE), or let it run again.
+ * when parking we wait until it is parked, so that only one thread
+ * drives the context.  there must not be any RPCs in flight.
+ */
+static void net_park(int n, int park) {
+    pthread_mutex_lock(&is[n].slock);
+    __atomic_store_n(&is[n].netpark, park, __ATOMIC_RELAXED);
+    if (park) {
+        while (!is[n].netparked) {
+            if (pthread_cond_wait(&is[n].ncond, &is[n].slock) != 0)
+                errx(1, "net park cond wait");
+        }
+    } else {
+        pthread_cond_signal(&is[n].ncond);
+    }
+    pthread_mutex_unlock(&is[n].slock);
+}
+
+/*
+ * inline_wait: INLINE wait for get_req() and wait_reqs().  we drive
+ * progress until all of instance n's RPCs have completed (if "all" is
+ * set) or until one has a free request.  forw_cb() and release_reqs()
+ * run in our thread here, so we can read the counters without the lock.
+ */
+static void inline_wait(int n, int all) {
+    while ((all) ? is[n].nsent != is[n].nissued :
+                   is[n].nissued - is[n].nsent >= (uint64_t)is[n].nreqs)
+        inline_poll(n, 1);
+}
+
+/*
+ * inline_poll: run instance n's callbacks that are ready and, if there
+ * were none, make progress (a zero timeout poll, or one call using the
+ * PROGRESS policy if "block" is set).  this is run_network()'s loop
+ * body, for INLINE phases.  returns the number of callbacks run.
+ */
+static int inline_poll(int n, int block) {
+    unsigned int actual;
+    hg_return_t ret;
+    int cnt;
+
+    cnt = 0;
+    do {
+        actual = 0;
+        ret = HG_Trigger(is[n].hgctx, 0, 1, &actual);
+        if (is[n].ndone) release_reqs(n);   /* HG_Trigger is done with them */
+        cnt += actual;
+    } while (ret == HG_SUCCESS && actual);
+    if (cnt == 0) {
+        if (block)
+            progress(is[n].hgctx, &g.prog);
+        else
+            HG_Progress(is[n].hgctx, 0);
+    }
+    if (g.interval) interval_report(n);
+    return(cnt);
+}
+
+/*
+ * batch_add: add a message made at time "made" to instance n's batch
+ * for target t.  the caller sends the batch when it is full.
+ */
+static void batch_add(int n, int t, uint64_t made) {
+    struct batch *b = &is[n].bat[t];
+    uint32_t len = g.phases[is[n].curphase].insz;
+
+    memcpy(b->buf + b->len, &len, BATCH_HDR);
+    memcpy(b->buf + b->len + BATCH_HDR, is[n].sendbuf, len);
+    b->len += BATCH_HDR + len;
+    b->stamps[b->nmsgs++] = made;
+}
+
+/*
+ * batch_send: send instance n's batch for target t as one RPC (waiting
+ * for the window to open) and empty it
+ */
+static void batch_send(int n, int t) {
+    struct batch *b = &is[n].bat[t];
+    struct sndreq *rq;
+    hg_handle_t rpchand;
+    hg_return_t ret;
+    rpcin_t in;
+
+    rq = get_req(n);
+    rpchand = req_handle(n, rq, t);
+    memcpy(rq->stamps, b->stamps, b->nmsgs * sizeof(*b->stamps));
+    rq->nmsgs = b->nmsgs;
+
+    if (!g.quiet) printf("%d: launching batch of %d\n", n, b->nmsgs);
+    in.ret = is[n].nissued;      /* only we change it */
+    in.origin = is[n].origin;
+    in.outsz = g.phases[is[n].curphase].outsz;
+    in.nmsgs = b->nmsgs;
+    in.data.len = b->len;
+    in.data.buf = b->buf;
+    rq->start = now_ns();
+    ret = HG_Forward(rpchand, forw_cb, rq, &in);
+    if (ret != HG_SUCCESS) errx(1, "hg forward batch failed");
+    b->len = b->nmsgs = 0;
+    if (g.phases[is[n].curphase].inprog)
+        inline_poll(n, 0);
+}
+
+/*
+ * batch_due: return the target of instance n's batch that has to be
+ * sent first if it is due by time "when" (its oldest message will have
+ * waited BATCH_FLUSH by then), or -1 if none are due.
+ */
+static int batch_due(int n, uint64_t when) {
+    struct batch *b;
+    int t, due;
+
+    for (due = -1, t = 0 ; t < g.ntargets ; t++) {
+        b = &is[n].bat[t];
+        if (b->nmsgs == 0 || b->stamps[0] + g.batchflush > when)
+            continue;
+        if (due < 0 || b->stamps[0] < is[n].bat[due].stamps[0])
+            due = t;
+    }
+    return(due);
+}
+
+/*
+ * interval_report: if an interval has passed since the last one, print
+ * instance n's stats for it (ops/sec, latency and RPCs in flight) and
+ * start a new one.  only called from the network thread (or from the
+ * sender in an INLINE phase).
+ */
+static void interval_report(int n) {
+    uint64_t now, ivns, inflight, p50, p99, cnt;
+    double secs;
+
+    /* cheap unlocked check first, since we are called all the time */
+    now = now_ns();
+    if (now - is[n].ivstart < (uint64_t)g.interval * 1000000000ULL)
+        return;
+
+    /* the sender resets the interval at the start of a phase */
+    pthread_mutex_lock(&is[n].slock);
+    if (!is[n].inphase) {
+        pthread_mutex_unlock(&is[n].slock);
+        return;
+    }
+    inflight = __atomic_load_n(&is[n].nissued, __ATOMIC_RELAXED) -
+               __atomic_load_n(&is[n].nsent, __ATOMIC_RELAXED);
+    ivns = now - is[n].ivstart;
+    secs = (now - is[n].phstart) / 1e9;
+    cnt = is[n].ivlat.cnt;
+    p50 = hist_pct(&is[n].ivlat, 50.0);
+    p99 = hist_pct(&is[n].ivlat, 99.0);
+    hist_reset(&is[n].ivlat);
+    is[n].ivstart = now;
+    pthread_mutex_unlock(&is[n].slock);
+
+    printf("%d: [%.1fs] interval ops/sec = %.1f, p50 = %llu nsec, "
+           "p99 = %llu nsec, in flight = %llu\n", n, secs, cnt * 1e9 / ivns,
+           (unsigned long long)p50, (unsigned long long)p99,
+           (unsigned long long)inflight);
+}
+
+/*
+ * create_handle: create a handle for sending instance n's RPC
+ */
+static void create_handle(int n, int t, hg_handle_t *hp) {
+    struct target *tp = &is[n].tgt[t];
+    hg_return_t ret;
+
+    ret = HG_Create(is[n].hgctx, tp->addr, target_rpcid(n, tp), hp);
+    if (ret != HG_SUCCESS) errx(1, "hg create failed");
+
+    /* shared class: send to the server context that matches the target */
+    if (g.shared && HG_Set_target_id(*hp, tp->m) != HG_SUCCESS)
+        errx(1, "hg set target id failed");
+}
+
+/*
+ * target_rpcid: return the ID of the RPC that instance n sends to
+ * target tp in the current phase
+ */
+static hg_id_t target_rpcid(int n, struct target *tp) {
+    if (g.bulkop)
+        return(tp->bulkid);
+    return((g.phases[is[n].curphase].zcopy) ? tp->zid : tp->rpcid);
+}
+
+/*
+ * target_handle: reset a (completed) handle of instance n so that it
+ * sends to target t.  the handle must be one whose request has been
+ * through release_reqs() (mercury has dropped its reference to it by
+ * then, HG_Reset() fails on a handle that is still in use).
+ */
+static void target_handle(int n, int t, hg_handle_t hand) {
+    struct target *tp = &is[n].tgt[t];
+
+    if (HG_Reset(hand, tp->addr, target_rpcid(n, tp)) != HG_SUCCESS)
+        errx(1, "reset hand failed");
+    if (g.shared && HG_Set_target_id(hand, tp->m) != HG_SUCCESS)
+        errx(1, "reset hand set target id failed");
+}
+
+/*
+ * req_handle: return a handle for sending request rq of instance n to
+ * target t (rq's pooled handle, reset and aimed at t, or a new one)
+ */
+static hg_handle_t req_handle(int n, struct sndreq *rq, int t) {
+    hg_handle_t hand;
+
+    if (g.phases[is[n].curphase].pool) {
+        hand = rq->hand;
+        target_handle(n, t, hand);    /* rq came from release_reqs() */
+    } else {
+        create_handle(n, t, &hand);
+    }
+    rq->t = t;
+    return(hand);
+}
+
+/*
+ * pick_target: return the target of instance n's next RPC (MESH only)
+ */
+static int pick_target(int n) {
+    uint64_t key = is[n].seq++;
+
+    switch (g.mesh) {
+    case MESH_RR:
+        return((n + key) % g.ntargets);
+    case MESH_RANDOM:
+        return(nrand48(is[n].xsubi) % g.ntargets);
+    default:       /* MESH_HASH: mix the key (splitmix64 finalizer) */
+        key += ((uint64_t)n << 32) + 0x9e3779b97f4a7c15ULL;
+        key = (key ^ (key >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        key = (key ^ (key >> 27)) * 0x94d049bb133111ebULL;
+        return((key ^ (key >> 31)) % g.ntargets);
+    }
+}
+
+/*
+ * setup_targets: fill in the servers instance n sends to.  without MESH
+ * this is just server n.  in MESH mode we look up the other servers'
+ * addresses (they all share one address with SHAREDCLASS) and register
+ * their RPC names (through the address cache with ADDRCACHE, in which
+ * case the cache owns the addresses).  with SHAREDCLASS the other
+ * instances have already registered the names in our class, so we use
+ * their IDs (all of the instances have passed readybar before we are
+ * called).
+ */
+static void setup_targets(int n) {
+    struct target *tp;
+    char name[64], id[256];
+    int t;
+
+    is[n].tgt = (struct target *)malloc(g.ntargets * sizeof(*is[n].tgt));
+    if (!is[n].tgt) errx(1, "malloc targets failed");
+    memset(is[n].tgt, 0, g.ntargets * sizeof(*is[n].tgt));
+    is[n].home = (g.mesh) ? n : 0;
+    for (t = 0 ; t < g.ntargets ; t++) {
+        tp = &is[n].tgt[t];
+        tp->m = (g.mesh) ? t : n;
+        if (tp->m == n) {
+            tp->addr = is[n].remoteaddr;
+            tp->rpcid = is[n].myrpcid;
+            tp->zid = is[n].myzid;
+            tp->bulkid = is[n].mybulkid;
+            continue;
+        }
+        if (g.shared) {
+            tp->addr = is[n].remoteaddr;
+            tp->rpcid = is[tp->m].myrpcid;
+            tp->zid = is[tp->m].myzid;
+            tp->bulkid = is[tp->m].mybulkid;
+            continue;
+        }
+        peer_id(tp->m, id, sizeof(id));
+        tp->addr = addr_get(n, id, &tp->ownaddr);
+        snprintf(name, sizeof(name), "f%d", tp->m);
+        tp->rpcid = HG_Register_name(is[n].hgclass, name, hg_proc_rpcin_t,
+                                     hg_proc_rpcout_t, rpchandler);
+        snprintf(name, sizeof(name), "z%d", tp->m);
+        tp->zid = HG_Register_name(is[n].hgclass, name, hg_proc_rpcin_z,
+                                   hg_proc_rpcout_z, rpchandler);
+        snprintf(name, sizeof(name), "b%d", tp->m);
+        tp->bulkid = HG_Register_name(is[n].hgclass, name, hg_proc_bulkin_t,
+                                      hg_proc_bulkout_t, rpchandler);
+    }
+    if (g.mesh) {
+        is[n].pairlat = (struct hist *)malloc(g.ntargets *
+                                              sizeof(*is[n].pairlat));
+        if (!is[n].pairlat) errx(1, "malloc pairlat failed");
+    }
+}
+
+/*
+ * mesh_report: print the ops/sec of each client->server pair for phase
+ * pno as a matrix (rows are client instances, columns are servers),
+ * with the total for each server in the last row.
+ */
+static void mesh_report(int pno) {
+    struct result *r;
+    double ops, *col;
+    int n, t;
+
+    col = (double *)malloc(g.ntargets * sizeof(*col));
+    if (!col) errx(1, "malloc mesh report failed");
+    for (t = 0 ; t < g.ntargets ; t++)
+        col[t] = 0;
+    printf("main: mesh ops/sec (client x server):\n");
+    printf("main: %6s", "");
+    for (t = 0 ; t < g.ntargets ; t++)
+        printf(" %10d", t);
+    printf("\n");
+    for (n = 0 ; n < g.ninst ; n++) {
+        r = &is[n].res[pno];
+        printf("main: %6d", n);
+        for (t = 0 ; t < g.ntargets ; t++) {
+            ops = r->pairrpcs[t] * 1e9 / r->nsec;
+            col[t] += ops;
+            printf(" %10.1f", ops);
+        }
+        printf("\n");
+    }
+    printf("main: %6s", "all");
+    for (t = 0 ; t < g.ntargets ; t++)
+        printf(" %10.1f", col[t]);
+    printf("\n");
+    free(col);
+}
+
+/*
+ * peer_id: put the address of server instance m in buf
+ */
+static void peer_id(int m, char *buf, int len) {
+    if (g.peers)
+        peertab_wait(g.peers, m, buf, len);
+    else
+        snprintf(buf, len, g.remotespec, m+BASEPORT);
+}
+
+/*
+ * addr_get: look up the address "id" for instance n.  with ADDRCACHE we
+ * look in the instance's address cache first and add what we look up
+ * to it (the cache owns the address, so *ownp is set to 0).  otherwise
+ * the caller owns the address and must free it (*ownp is set to 1).
+ */
+static hg_addr_t addr_get(int n, const char *id, int *ownp) {
+    hg_addr_t addr;
+
+    *ownp = !g.addrcache;
+    if (!g.addrcache)
+        return(lookup_remote(n, id));
+    if ((addr = acache_get(&is[n].ac, id)) != HG_ADDR_NULL)
+        return(addr);
+    addr = lookup_remote(n, id);
+    acache_put(&is[n].ac, id, addr);
+    return(addr);
+}
+
+/*
+ * acache_hash: hash an address string (64 bit FNV-1a)
+ */
+static uint64_t acache_hash(const char *id) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+
+    for ( ; *id ; id++)
+        h = (h ^ (unsigned char)*id) * 0x100000001b3ULL;
+    return(h);
+}
+
+/*
+ * acache_get: return the cached address for "id", HG_ADDR_NULL if
+ * it is not in the cache
+ */
+static hg_addr_t acache_get(struct acache *ac, const char *id) {
+    uint64_t i;
+
+    if (ac->size == 0)
+        return(HG_ADDR_NULL);
+    for (i = acache_hash(id) & (ac->size - 1) ; ac->ents[i].id ;
+         i = (i + 1) & (ac->size - 1)) {
+        if (strcmp(ac->ents[i].id, id) == 0)
+            return(ac->ents[i].addr);
+    }
+    return(HG_ADDR_NULL);
+}
+
+/*
+ * acache_put: add "id" (which must not be in the cache) and its
+ * address to the cache.  the cache takes ownership of the address.
+ */
+static void acache_put(struct acache *ac, const char *id, hg_addr_t addr) {
+    struct acache_ent *old;
+    uint64_t i;
+    int lcv, osize;
+
+    if ((ac->nents + 1) * 2 > ac->size) {     /* grow and rehash */
+        old = ac->ents;
+        osize = ac->size;
+        ac->size = (osize) ? osize * 2 : ACACHE_MIN;
+        ac->ents = (struct acache_ent *)calloc(ac->size, sizeof(*ac->ents));
+        if (!ac->ents) errx(1, "malloc address cache failed");
+        for (lcv = 0 ; lcv < osize ; lcv++) {
+            if (old[lcv].id == NULL)
+                continue;
+            for (i = acache_hash(old[lcv].id) & (ac->size - 1) ;
+                 ac->ents[i].id ; i = (i + 1) & (ac->size - 1))
+                /* find an empty slot */ ;
+            ac->ents[i] = old[lcv];
+        }
+        free(old);
+    }
+    for (i = acache_hash(id) & (ac->size - 1) ; ac->ents[i].id ;
+         i = (i + 1) & (ac->size - 1))
+        /* find an empty slot */ ;
+    ac->ents[i].id = strdup(id);
+    if (!ac->ents[i].id) errx(1, "strdup address cache id failed");
+    ac->ents[i].addr = addr;
+    ac->nents++;
+}
+
+/*
+ * acache_free: free instance n's cached addresses and empty the cache
+ */
+static void acache_free(int n, struct acache *ac) {
+    int lcv;
+
+    for (lcv = 0 ; lcv < ac->size ; lcv++) {
+        if (ac->ents[lcv].id == NULL)
+            continue;
+        HG_Addr_free(is[n].hgclass, ac->ents[lcv].addr);
+        free(ac->ents[lcv].id);
+    }
+    free(ac->ents);
+    ac->ents = NULL;
+    ac->size = ac->nents = 0;
+}
+
+/*
+ * lookup_bench: the LOOKUP benchmark for instance n.  in the first
+ * round we look up each peer server (but not our own, which we have
+ * already looked up and talked to), add it to the address cache, and
+ * send it our ready RPCs, timing the first one apart from the rest.
+ * in each later round we look up each peer again through mercury
+ * (and free the address) and then through the cache.  the results go
+ * in is[n].lk (shared memory with FORK) for main.  the cache is kept
+ * for setup_targets() with ADDRCACHE.
+ */
+static void lookup_bench(int n) {
+    struct lookupstats *lk;
+    hg_addr_t addr;
+    hg_id_t rid;
+    char name[64], id[256];
+    uint64_t t0, t1;
+    int r, m, k;
+
+    lk = is[n].lk = (struct lookupstats *)shm_alloc(sizeof(*lk));
+    if (!lk) errx(1, "malloc lookup stats failed");
+    t0 = now_ns();
+    for (r = 0 ; r < g.lookup ; r++) {
+        for (m = 0 ; m < g.lookuppeers ; m++) {
+            if (m == n)
+                continue;
+            peer_id(m, id, sizeof(id));
+            if (r > 0) {
+                t1 = now_ns();
+                if (lookup_addr(n, id, &addr) < 0)
+                    errx(1, "%d: lookup of %s failed", n, id);
+                hist_record(&lk->again, now_ns() - t1);
+                HG_Addr_free(is[n].hgclass, addr);
+                t1 = now_ns();
+                if (acache_get(&is[n].ac, id) == HG_ADDR_NULL)
+                    errx(1, "%d: %s not in the address cache", n, id);
+                hist_record(&lk->cached, now_ns() - t1);
+                continue;
+            }
+            t1 = now_ns();
+            if (lookup_addr(n, id, &addr) < 0)
+                errx(1, "%d: lookup of %s failed", n, id);
+            hist_record(&lk->cold, now_ns() - t1);
+            acache_put(&is[n].ac, id, addr);
+            lk->npeers++;
+
+            snprintf(name, sizeof(name), "r%d", m);
+            rid = HG_Register_name(is[n].hgclass, name, hg_proc_ready_t,
+                                   hg_proc_ready_t, rpchandler);
+            for (k = 0 ; k < g.lookuprpcs ; k++) {
+                t1 = now_ns();
+                if (ctl_rpc(n, addr, m, rid, READY_WAIT, NULL) < 0)
+                    errx(1, "%d: ready RPC to server %d failed", n, m);
+                hist_record((k == 0) ? &lk->first : &lk->later,
+                            now_ns() - t1);
+            }
+        }
+    }
+    lk->nsec = now_ns() - t0;
+    if (!g.addrcache)
+        acache_free(n, &is[n].ac);
+
+    printf("%d: lookup: %d peers in %.3f msec, p50 nsec: cold %llu, "
+           "again %llu, cached %llu, first rpc %llu, later rpc %llu\n", n,
+           lk->npeers, lk->nsec / 1e6,
+           (unsigned long long)hist_pct(&lk->cold, 50.0),
+           (unsigned long long)hist_pct(&lk->again, 50.0),
+           (unsigned long long)hist_pct(&lk->cached, 50.0),
+           (unsigned long long)hist_pct(&lk->first, 50.0),
+           (unsigned long long)hist_pct(&lk->later, 50.0));
+}
+
+/*
+ * lookup_report: merge the LOOKUP results of all the instances and
+ * print them, with the speedup of the address cache over looking an
+ * address up again and the cost of the first RPC to a peer over a
+ * later one.
+ */
+static void lookup_report() {
+    struct lookupstats *all;
+    uint64_t maxns;
+    int n;
+
+    all = (struct lookupstats *)malloc(sizeof(*all));
+    if (!all) errx(1, "malloc lookup report failed");
+    memset(all, 0, sizeof(*all));
+    for (maxns = 0, n = 0 ; n < g.ninst ; n++) {
+        if (is[n].lk == NULL)
+            continue;
+        all->npeers += is[n].lk->npeers;
+        if (is[n].lk->nsec > maxns) maxns = is[n].lk->nsec;
+        hist_merge(&all->cold, &is[n].lk->cold);
+        hist_merge(&all->again, &is[n].lk->again);
+        hist_merge(&all->cached, &is[n].lk->cached);
+        hist_merge(&all->first, &is[n].lk->first);
+        hist_merge(&all->later, &is[n].lk->later);
+    }
+    printf("main: lookup: %d peer lookups, slowest instance took %.3f "
+           "msec\n", all->npeers, maxns / 1e6);
+    hist_print("main", "cold address lookup", &all->cold);
+    hist_print("main", "repeated address lookup", &all->again);
+    hist_print("main", "cached address lookup", &all->cached);
+    hist_print("main", "first rpc to a peer", &all->first);
+    hist_print("main", "later rpcs to a peer", &all->later);
+    if (all->again.cnt && all->cached.sum)
+        printf("main: address cache: repeated lookups %.1fx faster (avg "
+               "%.1f -> %.1f nsec)\n",
+               ((double)all->again.sum / all->again.cnt) /
+               ((double)all->cached.sum / all->cached.cnt),
+               (double)all->again.sum / all->again.cnt,
+               (double)all->cached.sum / all->cached.cnt);
+    if (all->first.cnt && all->later.cnt)
+        printf("main: first rpc to a peer costs %.1fx a later one (p50 %llu "
+               "vs %llu nsec)\n", (double)hist_pct(&all->first, 50.0) /
+               hist_pct(&all->later, 50.0),
+               (unsigned long long)hist_pct(&all->first, 50.0),
+               (unsigned long long)hist_pct(&all->later, 50.0));
+    free(all);
+}
+
+/*
+ * phase_name: print a short description of a phase into buf
+ */
+static void phase_name(int pno, char *buf, int len) {
+    struct phase *p = &g.phases[pno];
+    char win[64];
+
+    if (p->window)
+        snprintf(win, sizeof(win), "%d", p->window);
+    else
+        snprintf(win, sizeof(win), "unlimited");
+    if (p->rate)
+        snprintf(win + strlen(win), sizeof(win) - strlen(win), " rate=%d",
+                 p->rate);
+    if (p->batch)
+        snprintf(win + strlen(win), sizeof(win) - strlen(win), " batch=%d",
+                 p->batch);
+
+    if (g.bulkop)
+        snprintf(buf, len,
+                 "[window=%s bulk=%s bulksize=%d handles=%s%s%s]",
+                 win, (g.bulkop == BULKOP_PULL) ? "pull" : "push", p->bulksz,
+                 (p->pool) ? "pool" : "create",
+                 (p->lockfree) ? " lock-free" : "",
+                 (p->inprog) ? " progress=inline" : "");
+    else
+        snprintf(buf, len,
+                 "[window=%s insize=%d outsize=%d handles=%s%s%s%s]",
+                 win, p->insz, p->outsz, (p->pool) ? "pool" : "create",
+                 (p->zcopy) ? " procs=zero-copy" : "",
+                 (p->lockfree) ? " lock-free" : "",
+                 (p->inprog) ? " progress=inline" : "");
+}
+
+/*
+ * phase_record: write a results record for phase pno.  instance is the
+ * instance number, or -1 for the aggregate of all instances (where nsec
+ * is the time of the slowest instance).
+ */
+static void phase_record(int pno, int instance, uint64_t nrpcs,
+                         uint64_t nmsgs, uint64_t nsec, uint64_t cpu,
+                         const struct hist *lat,
+                         const struct hist *msglat) {
+    struct phase *p = &g.phases[pno];
+    struct runrec rr;
+    int lcv;
+
+    if (g.results == NULL)
+        return;
+    rr.prog = "client";
+    rr.tag = g.tag;
+    rr.transport = g.transport;
+    rr.ninst = g.ninst;
+    rr.instance = instance;
+    rr.layout = (g.fork) ? "per-process" :
+                ((g.shared) ? "shared" : "per-instance");
+    rr.progress = progress_name(&g.prog);
+    rr.affinity = affinity_name(&g.aff);
+    rr.mode = (g.bulkop == BULKOP_PULL) ? "bulk-pull" :
+              ((g.bulkop == BULKOP_PUSH) ? "bulk-push" :
+               ((p->zcopy) ? "rpc-zero-copy" : "rpc"));
+    rr.window = p->window;
+    rr.rate = p->rate;
+    rr.insz = p->insz;
+    rr.outsz = p->outsz;
+    rr.bulksz = p->bulksz;
+    rr.handles = (p->pool) ? "pool" : "create";
+    rr.completion = (p->lockfree) ? "lock-free" : "lock";
+    rr.progthread = (p->inprog) ? "sender" : "network";
+    rr.nrpcs = nrpcs;
+    rr.nsec = nsec;
+    if (instance >= 0) {
+        rr.ops = nrpcs * 1e9 / nsec;
+        rr.mops = nmsgs * 1e9 / nsec;
+    } else {   /* sum of the instance rates, like the printed summary */
+        for (rr.ops = rr.mops = 0, lcv = 0 ; lcv < g.ninst ; lcv++) {
+            rr.ops += is[lcv].res[pno].nrpcs * 1e9 / is[lcv].res[pno].nsec;
+            rr.mops += is[lcv].res[pno].nmsgs * 1e9 / is[lcv].res[pno].nsec;
+        }
+    }
+    rr.mbs = phase_mbs(pno, rr.ops, rr.mops);
+    if (!g.bidir) {
+        rr.revops = -1;
+    } else if (instance >= 0) {
+        rr.revops = is[instance].res[pno].nrev * 1e9 / nsec;
+    } else {
+        for (rr.revops = 0, lcv = 0 ; lcv < g.ninst ; lcv++)
+            rr.revops += is[lcv].res[pno].nrev * 1e9 / is[lcv].res[pno].nsec;
+    }
+    rr.cpu = cpu;
+    rr.lat = lat;
+    rr.batch = p->batch;
+    rr.nmsgs = nmsgs;
+    rr.msglat = msglat;
+    results_write(g.results, &rr);
+}
+
+/*
+ * rate_group: return non-zero if open loop phases a and b only differ
+ * in their rate (i.e. they are part of the same rate sweep)
+ */
+static int rate_group(int a, int b) {
+    struct phase *p = &g.phases[a], *q = &g.phases[b];
+    return(p->rate && q->rate && p->window == q->window &&
+           p->insz == q->insz && p->outsz == q->outsz &&
+           p->bulksz == q->bulksz && p->batch == q->batch &&
+           p->zcopy == q->zcopy && p->pool == q->pool &&
+           p->lockfree == q->lockfree && p->inprog == q->inprog);
+}
+
+/*
+ * find_twin: return the earlier phase that is the same as phase pno
+ * but with the given pool, lockfree, and inprog settings, or -1 if none
+ */
+static int find_twin(int pno, int pool, int lockfree, int inprog) {
+    struct phase *p = &g.phases[pno], *q;
+    int k;
+
+    for (k = 0 ; k < pno ; k++) {
+        q = &g.phases[k];
+        if (p->window == q->window && p->insz == q->insz &&
+            p->outsz == q->outsz && p->bulksz == q->bulksz &&
+            p->rate == q->rate && p->batch == q->batch &&
+            p->zcopy == q->zcopy && q->pool == pool &&
+            q->lockfree == lockfree && q->inprog == inprog)
+            return(k);
+    }
+    return(-1);
+}
+
+/*
+ * knee_report: for each rate sweep, print its knee (see top of file)
+ * given the aggregate ops/sec, msgs/sec, and p99 latency of each phase.
+ * with BATCH the rate is in messages, so we check msgs/sec against it.
+ * the lowest rate is the first one in the sweep.
+ */
+static void knee_report(double *ops, double *mops, uint64_t *p99) {
+    int pno, k, knee, fail, nrates;
+    char pname[128];
+    double *got;
+
+    for (pno = 0 ; pno < g.nphases ; pno++) {
+        for (k = 0 ; k < pno && !rate_group(k, pno) ; k++)
+            /* find the first phase of the sweep */ ;
+        if (k < pno || !g.phases[pno].rate)
+            continue;    /* already reported, or not open loop */
+
+        knee = fail = -1;
+        for (nrates = 0, k = pno ; k < g.nphases ; k++) {
+            if (!rate_group(pno, k))
+                continue;
+            nrates++;
+            if (fail >= 0)
+                continue;
+            got = (g.phases[k].batch) ? mops : ops;
+            if (got[k] < KNEE_TPUT * g.phases[k].rate * g.ninst ||
+                p99[k] > KNEE_LAT * p99[pno])
+                fail = k;
+            else
+                knee = k;
+        }
+        if (nrates < 2)
+            continue;    /* not a sweep */
+
+        phase_name(pno, pname, sizeof(pname));
+        if (knee < 0)
+            printf("main: %s: knee is below the lowest rate\n", pname);
+        else if (fail < 0)
+            printf("main: %s: knee not reached, rate=%d sustained "
+                   "(p99 = %llu nsec)\n", pname, g.phases[knee].rate,
+                   (unsigned long long)p99[knee]);
+        else
+            printf("main: %s: knee at rate=%d per instance, %.1f %s/sec, "
+                   "p99 = %llu nsec (rate=%d is not sustained)\n", pname,
+                   g.phases[knee].rate, (g.phases[knee].batch) ?
+                   mops[knee] : ops[knee],
+                   (g.phases[knee].batch) ? "msgs" : "ops",
+                   (unsigned long long)p99[knee], g.phases[fail].rate);
+    }
+}
+
+/*
+ * batch_report: print the aggregate message rate, messages per RPC, and
+ * message latency of each BATCH phase in one table (given the ops/sec,
+ * msgs/sec, and message p50 and p99 latency of each phase), so the
+ * effect of the batch size can be seen at a glance.
+ */
+static void batch_report(double *ops, double *mops, uint64_t *p50,
+                         uint64_t *p99) {
+    int pno, nbatch;
+    char pname[128];
+
+    for (nbatch = pno = 0 ; pno < g.nphases ; pno++) {
+        if (g.phases[pno].batch) nbatch++;
+    }
+    if (nbatch < 2)
+        return;    /* nothing to compare */
+
+    printf("main: batch sweep:\n");
+    printf("main: %-50s %12s %8s %10s %10s\n", "phase", "msgs/sec",
+           "msgs/rpc", "p50 nsec", "p99 nsec");
+    for (pno = 0 ; pno < g.nphases ; pno++) {
+        if (!g.phases[pno].batch)
+            continue;
+        phase_name(pno, pname, sizeof(pname));
+        printf("main: %-50s %12.1f %8.1f %10llu %10llu\n", pname, mops[pno],
+               (ops[pno] > 0) ? mops[pno] / ops[pno] : 0.0,
+               (unsigned long long)p50[pno], (unsigned long long)p99[pno]);
+    }
+}
+
+/*
+ * zcopy_report: compare each ZEROCOPY phase with the same phase run
+ * with the generated procs (given the aggregate ops/sec, cpu nsec per
+ * RPC, and p50 latency of each phase) in one table, so the cost of
+ * serialization at each payload size can be seen at a glance.
+ */
+static void zcopy_report(double *ops, uint64_t *cpurpc, uint64_t *p50) {
+    struct phase *p, *q;
+    int pno, gen, hdr;
+    char pname[128];
+
+    for (hdr = 0, pno = 0 ; pno < g.nphases ; pno++) {
+        p = &g.phases[pno];
+        if (!p->zcopy)
+            continue;
+        for (gen = 0 ; gen < g.nphases ; gen++) {   /* find its twin */
+            q = &g.phases[gen];
+            if (!q->zcopy && p->window == q->window && p->insz == q->insz &&
+                p->outsz == q->outsz && p->rate == q->rate &&
+                p->batch == q->batch && p->pool == q->pool &&
+                p->lockfree == q->lockfree && p->inprog == q->inprog)
+                break;
+        }
+        if (gen >= g.nphases)
+            continue;     /* not run with the generated procs */
+
+        if (hdr++ == 0) {
+            printf("main: zero-copy vs generated procs:\n");
+            printf("main: %-50s %12s %12s %7s %9s %9s %9s %9s\n", "phase",
+                   "gen ops/sec", "zc ops/sec", "change", "gen cpu",
+                   "zc cpu", "gen p50", "zc p50");
+        }
+        phase_name(gen, pname, sizeof(pname));
+        printf("main: %-50s %12.1f %12.1f %+6.1f%% %9llu %9llu %9llu "
+               "%9llu\n", pname, ops[gen], ops[pno],
+               100.0 * (ops[pno] - ops[gen]) / ops[gen],
+               (unsigned long long)cpurpc[gen],
+               (unsigned long long)cpurpc[pno],
+               (unsigned long long)p50[gen], (unsigned long long)p50[pno]);
+    }
+}
+
+/*
+ * phase_mbs: MB/s of data moved in a phase at "ops" RPCs/sec (the
+ * request and reply payloads, plus the bulk transfer in bulk mode).
+ * with BATCH the request data is the messages, at "mops" msgs/sec.
+ */
+static double phase_mbs(int pno, double ops, double mops) {
+    struct phase *p = &g.phases[pno];
+    if (p->batch)
+        return((mops * p->insz + ops * p->outsz) / 1e6);
+    return(ops * (p->insz + p->outsz + p->bulksz) / 1e6);
+}
+
+/*
+ * lookup_cb: this gets called when HG_Addr_lookup() completes.
+ * we need to stash the results and wake the caller.
+ */
+static hg_return_t lookup_cb(const struct hg_cb_info *cbi) {
+    struct lookup_state *lstp = (struct lookup_state *)cbi->arg;
+
+#if 0  
+    /* 
+     * XXX: bug, hg_core_trigger_lookup_entry() sets it to HG_CB_BULK
+     * instead of HG_CB_LOOKUP.  bug.  jerome fixed feb 2, 2017
+     */
+    if (cbi->type != HG_CB_LOOKUP) 
+        errx(1, "lookup_cb mismatch %d", cbi->type);
+#endif
+
+    pthread_mutex_lock(&lstp->lock);
+    if (cbi->ret != HG_SUCCESS) {
+        warnx("lookup_cb failed %d\n", cbi->ret);
+        lstp->done = -1;
+    } else {
+        lstp->addr = cbi->info.lookup.addr;
+        lstp->done = 1;
+    }
+    pthread_mutex_unlock(&lstp->lock);
+    pthread_cond_signal(&lstp->lkupcond);
+
+    return(HG_SUCCESS);
+}
+
+/*
+ * ready_cb: this gets called when a control (ready, done, or shutdown)
+ * RPC completes (or fails).  we save the reply value and wake the caller.
+ */
+static hg_return_t ready_cb(const struct hg_cb_info *cbi) {
+    struct lookup_state *rstp = (struct lookup_state *)cbi->arg;
+    hg_handle_t hand = cbi->info.forward.handle;
+    ready_t out;
+    int rv = -1;
+
+    if (cbi->ret == HG_SUCCESS && HG_Get_output(hand, &out) == HG_SUCCESS) {
+        rstp->ret = out.ret;
+        HG_Free_output(hand, &out);
+        rv = 1;
+    }
+    pthread_mutex_lock(&rstp->lock);
+    rstp->done = rv;
+    pthread_mutex_unlock(&rstp->lock);
+    pthread_cond_signal(&rstp->lkupcond);
+
+    return(HG_SUCCESS);
+}
+
+/*
+ * revhandler: called when one of the server's reverse RPCs comes in
+ * (BIDIR).  this runs in whichever thread is driving progress for the
+ * instance (the network thread, or the sender with INLINE).  we reply
+ * with the payload size the server asked for and count it.
+ */
+static hg_return_t revhandler(hg_handle_t handle) {
+    struct hg_info *hgi;
+    hg_return_t ret;
+    rpcin_t in;
+    rpcout_t out;
+    int n;
+
+    hgi = HG_Get_info(handle);
+    if (!hgi) errx(1, "bad hgi");
+    n = *((int *)HG_Registered_data(hgi->hg_class, hgi->id));
+    ret = HG_Get_input(handle, &in);
+    if (ret != HG_SUCCESS) errx(1, "HG_Get_input reverse failed");
+    out.ret = in.ret * -1;
+    out.data.len = ((int)in.outsz < is[n].revbufsz) ? in.outsz :
+                   is[n].revbufsz;
+    out.data.buf = is[n].revbuf;
+    HG_Free_input(handle, &in);
+
+    ret = HG_Respond(handle, rev_sent_cb, NULL, &out);
+    if (ret != HG_SUCCESS) errx(1, "HG_Respond reverse failed");
+    __atomic_add_fetch(&is[n].nrev, 1, __ATOMIC_RELAXED);
+    return(HG_SUCCESS);
+}
+
+/*
+ * rev_sent_cb: called after our reply to a reverse RPC has been sent
+ */
+static hg_return_t rev_sent_cb(const struct hg_cb_info *cbi) {
+    if (cbi->type != HG_CB_RESPOND) errx(1, "unexpected reverse sent cb");
+    HG_Destroy(cbi->info.respond.handle);
+    return(HG_SUCCESS);
+}
+
+/*
+ * forw_cb: this gets called on the client side when HG_Forward() completes
+ * (i.e. when we get the reply from the remote side).
+ */
+static hg_return_t forw_cb(const struct hg_cb_info *cbi) {
+    struct sndreq *rq = (struct sndreq *)cbi->arg;
+    uint64_t end = now_ns();
+    int n, lcv;
+    hg_handle_t hand;
+    hg_return_t ret;
+    rpcout_t out;
+    bulkout_t bout;
+
+    n = rq->n;
+    if (cbi->ret != HG_SUCCESS) errx(1, "forw_cb failed");
+    if (cbi->type != HG_CB_FORWARD) errx(1, "forw_cb wrong type");
+    hand = cbi->info.forward.handle;
+
+    if (g.bulkop) {
+        ret = HG_Get_output(hand, &bout);
+        if (ret != HG_SUCCESS) errx(1, "get bulk output failed");
+        if (!g.quiet) printf("%d: forw complete (code=%d)\n", n, bout.ret);
+        HG_Free_output(hand, &bout);
+    } else {
+        ret = HG_Get_output(hand, &out);
+        if (ret != HG_SUCCESS) errx(1, "get output failed");
+        if (!g.quiet) printf("%d: forw complete (code=%d)\n", n, out.ret);
+        if (out.data.len !=
+            (hg_uint32_t)g.phases[is[n].curphase].outsz)
+            errx(1, "forw_cb: reply payload size mismatch");
+        HG_Free_output(hand, &out);
+    }
+
+    /* a pooled handle stays with rq (req_handle() resets it for reuse) */
+    if (!g.phases[is[n].curphase].pool) {
+        if (HG_Destroy(hand) != HG_SUCCESS) errx(1, "forw_cb destroy hand");
+    }
+
+    /* only the network thread records latency, so no lock needed */
+    hist_record(is[n].lat, end - rq->start);
+    if (g.interval)
+        hist_record(&is[n].ivlat, end - rq->start);
+    if (g.mesh) {
+        hist_record(&is[n].pairlat[rq->t], end - rq->start);
+        is[n].res[is[n].curphase].pairrpcs[rq->t]++;
+    }
+    if (rq->nmsgs) {  /* batch: each message's latency */
+        for (lcv = 0 ; lcv < rq->nmsgs ; lcv++)
+            hist_record(is[n].msglat, end - rq->stamps[lcv]);
+        is[n].res[is[n].curphase].nmsgs += rq->nmsgs;
+    }
+
+    /*
+     * mercury holds a reference to the handle until we return to
+     * HG_Trigger(), so the sender can't have rq (and reset its pooled
+     * handle) yet.  our caller frees it with release_reqs() after
+     * HG_Trigger() returns.
+     */
+    is[n].donereqs[is[n].ndone++] = rq;
+    
+    return(HG_SUCCESS);
+}
+
+/*
+ * release_reqs: free instance n's completed requests and wake the
+ * sender if it is waiting for one.  called by the thread that runs
+ * HG_Trigger() (after it returns, see forw_cb).
+ */
+static void release_reqs(int n) {
+    int lcv;
+
+    if (g.phases[is[n].curphase].lockfree) {
+        for (lcv = 0 ; lcv < is[n].ndone ; lcv++) {
+            if (workq_push(&is[n].freeq, is[n].donereqs[lcv]) != 0)
+                errx(1, "release_reqs: freeq full");
+        }
+        /* only we change nsent, release publishes forw_cb's stats */
+        __atomic_store_n(&is[n].nsent, is[n].nsent + is[n].ndone,
+                         __ATOMIC_RELEASE);
+        is[n].ndone = 0;
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        lf_wake(n);
+        return;
+    }
+    pthread_mutex_lock(&is[n].slock);
+    for (lcv = 0 ; lcv < is[n].ndone ; lcv++)
+        is[n].freereqs[is[n].nfree++] = is[n].donereqs[lcv];
+    is[n].nsent += is[n].ndone;
+    is[n].ndone = 0;
+    if (is[n].swaiting) {
+        is[n].swaiting = 0;
+        pthread_cond_signal(&is[n].scond);
+    }
+    pthread_mutex_unlock(&is[n].slock);
+}
+
+/*
+ * run_network: network support pthread.   need to call progress to push the
+ * network and then trigger to run the callback.  we do this all in 
+ * one thread (meaning that we shouldn't block in the trigger function, 
+ * or we won't make progress).  since we only have one thread running
+ * trigger callback, we do not need to worry about concurrent access to
+ * "got" ...
+ */
+static void *run_network(void *arg) {
+    int n = *((int *)arg);
+    unsigned int actual; 
+    hg_return_t ret;
+    actual = 0;
+
+    affinity_pin(g.aff.net[n]);
     printf("%d: network thread running\n", n);
     /* while (not done sending or not done recving */
     while (!is[n].sends_done) {
 
+        if (__atomic_load_n(&is[n].netpark, __ATOMIC_RELAXED)) {
+            /* the sender drives progress (INLINE), wait until it is done */
+            pthread_mutex_lock(&is[n].slock);
+            is[n].netparked = 1;
+            pthread_cond_signal(&is[n].ncond);
+            while (is[n].netpark) {
+                if (pthread_cond_wait(&is[n].ncond, &is[n].slock) != 0)
+                    errx(1, "net parked cond wait");
+            }
+            is[n].netparked = 0;
+            pthread_mutex_unlock(&is[n].slock);
+            continue;
+        }
+
         do {
             ret = HG_Trigger(is[n].hgctx, 0, 1, &actual);
+            if (is[n].ndone) release_reqs(n);   /* see forw_cb */
         } while (ret == HG_SUCCESS && actual);
 
         if (!is[n].sends_done) {
-            HG_Progress(is[n].hgctx, 100);
+            progress(is[n].hgctx, &g.prog);
         }
+        if (g.interval) interval_report(n);
     }
     printf("%d: network thread complete\n", n);
 }
@@ -0,0 +1,131 @@
+/*
+ * sndrcv-loop.cc  test mercury  (client and server in one process)
+ */
+
+/*
+ * this program runs the sndrcv-srvr server and the sndrcv-client client
+ * in the same process, so that one command gives a full benchmark of a
+ * transport on a single machine (e.g. over shared memory or loopback
+ * tcp) without having to start two programs with matching settings.
+ *
+ * we compile both programs into this one, each in its own namespace,
+ * and run the server's main() in a thread while the client's main()
+ * runs in ours.  the client and server take all their settings from
+ * the environment as usual (so COUNT, SIZE, SHAREDCLASS, etc. apply to
+ * both sides).  the server publishes each instance's listening address
+ * once it is up (see struct peertab) and the client sends to those
+ * addresses, so transports whose addresses are only known after
+ * HG_Init() (like na+sm) work too.  the client's done RPCs stop the
+ * server as usual and we exit when both sides are finished.
+ *
+ * if RESULTS is set, both sides append their records to that file.
+ *
+ * usage: ./sndrcv-loop n-instances [addr-spec]
+ *
+ * the address spec is used for both the client and the server.  it
+ * may use a %d for the port (as in sndrcv-srvr) and defaults to DEF_SPEC.
+ *
+ * example:
+ *   ./sndrcv-loop 1                              # 1 instance over na+sm
+ *   ./sndrcv-loop 2 bmi+tcp://127.0.0.1:%d       # 2 instances, tcp
+ *                                                # ports=19900-19903
+ */
+
+#include <assert.h>
+#include <err.h>
+#include <errno.h>
+#include <math.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+
+#include <mercury.h>
+#include <mercury_macros.h>
+
+#include "sndrcv-rpc.h"
+#include "sndrcv-util.h"
+
+/*
+ * the two programs (their headers are already included above, so
+ * these just bring in the code)
+ */
+namespace srvr {
+#include "sndrcv-srvr.cc"
+}
+namespace client {
+#include "sndrcv-client.cc"
+}
+
+#define DEF_SPEC "na+sm"   /* default address spec */
+
+/*
+ * srvrargs: the command line we give the server's main()
+ */
+struct srvrargs {
+    int argc;
+    char *argv[4];
+    int ret;                 /* what main() returned */
+};
+
+/*
+ * run_srvr: server thread.  just calls the server's main().
+ */
+static void *run_srvr(void *arg) {
+    struct srvrargs *sa = (struct srvrargs *)arg;
+
+    sa->ret = srvr::main(sa->argc, sa->argv);
+    return(NULL);
+}
+
+/*
+ * main program: start the server, run the client, wait for the server
+ */
+int main(int argc, char **argv) {
+    struct peertab peers;
+    struct srvrargs sa;
+    pthread_t sthread;
+    char *spec, *cargv[5];
+    FILE *fp;
+    int ninst, rv;
+
+    if (argc < 2 || argc > 3)
+        errx(0, "usage: %s n-instances [addr-spec]", *argv);
+    ninst = atoi(argv[1]);
+    if (ninst < 1) errx(1, "bad number of instances: %s", argv[1]);
+    spec = (argc > 2) ? argv[2] : (char *)DEF_SPEC;
+    printf("loop: %d instances, address spec %s\n", ninst, spec);
+
+    /* write the results header now, so that the two sides can't race */
+    if ((fp = results_open(getenv("RESULTS"))) != NULL)
+        fclose(fp);
+
+    peertab_init(&peers, ninst);
+    srvr::g.peers = &peers;
+    client::g.peers = &peers;
+
+    sa.argc = 3;
+    sa.argv[0] = (char *)"sndrcv-srvr";
+    sa.argv[1] = argv[1];
+    sa.argv[2] = spec;
+    sa.argv[3] = NULL;
+    sa.ret = 0;
+    rv = pthread_create(&sthread, NULL, run_srvr, &sa);
+    if (rv != 0) errx(1, "pthread create srvr failed");
+
+    cargv[0] = (char *)"sndrcv-client";
+    cargv[1] = argv[1];
+    cargv[2] = spec;
+    cargv[3] = spec;
+    cargv[4] = NULL;
+    rv = client::main(4, cargv);
+
+    pthread_join(sthread, NULL);
+    peertab_free(&peers);
+    printf("loop: done (client %d, server %d)\n", rv, sa.ret);
+    return((rv != 0) ? rv : sa.ret);
+}
@@ -0,0 +1,202 @@
+/*
+ * sndrcv-rpc.h  test mercury  (RPC input/output shared by client and server)
+ */
+
+/*
+ * the client and server must agree on the format of the RPC input
+ * and output structures, so we define them here in one place.
+ */
+
+#ifndef SNDRCV_RPC_H
+#define SNDRCV_RPC_H
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <mercury.h>
+#include <mercury_bulk.h>
+#include <mercury_macros.h>
+#include <mercury_proc_bulk.h>
+
+/*
+ * payload_t: a variable-length opaque payload.  on encode we send
+ * "len" bytes from "buf".  on decode we malloc a buffer and copy the
+ * payload into it (freed by HG_Free_input/HG_Free_output).
+ */
+typedef struct {
+    hg_uint32_t len;         /* length of payload */
+    void *buf;               /* payload data */
+} payload_t;
+
+static inline hg_return_t hg_proc_payload_t(hg_proc_t proc, void *data) {
+    payload_t *pl = (payload_t *)data;
+    hg_return_t ret;
+
+    ret = hg_proc_uint32_t(proc, &pl->len);
+    if (ret != HG_SUCCESS || pl->len == 0)
+        return(ret);
+
+    switch (hg_proc_get_op(proc)) {
+    case HG_ENCODE:
+        ret = hg_proc_raw(proc, pl->buf, pl->len);
+        break;
+    case HG_DECODE:
+        pl->buf = malloc(pl->len);
+        if (pl->buf == NULL)
+            return(HG_NOMEM_ERROR);
+        ret = hg_proc_raw(proc, pl->buf, pl->len);
+        break;
+    case HG_FREE:
+        free(pl->buf);
+        pl->buf = NULL;
+        break;
+    }
+
+    return(ret);
+}
+
+/*
+ * input and output structures (this also generates XDR fns using boost pp).
+ * the client tells the server how big a reply payload it wants in "outsz".
+ * "origin" is the number the server gave the client instance in its
+ * reply to the ready RPC (so the server can keep per-client stats).
+ *
+ * if "nmsgs" is non-zero the request is a batch of that many logical
+ * messages (see BATCH in sndrcv-client.cc) packed into the payload as
+ * records of a 32 bit length (in host byte order) followed by the data.
+ */
+MERCURY_GEN_PROC(rpcin_t, ((int32_t)(ret))((int32_t)(origin))
+                          ((uint32_t)(outsz))((uint32_t)(nmsgs))
+                          ((payload_t)(data)))
+MERCURY_GEN_PROC(rpcout_t, ((int32_t)(ret))((payload_t)(data)))
+#define BATCH_HDR 4          /* bytes of length before each batched message */
+
+/*
+ * zero-copy procs for rpcin_t and rpcout_t (the "z%d" RPC, see ZEROCOPY
+ * in sndrcv-client.cc).  these move the same fields as the generated
+ * procs above, but the fixed fields go in as one block and the payload
+ * is copied straight into mercury's buffer with hg_proc_save_ptr()
+ * (both in one step on encode).  on decode "data.buf" points at the
+ * payload in mercury's buffer instead of a malloc'd copy, so it is only
+ * valid until HG_Free_input()/HG_Free_output() (which has nothing to
+ * free).  the fixed fields are in host byte order, so the client and
+ * server must have the same byte order.
+ */
+struct rpcin_hdr {
+    int32_t ret;
+    int32_t origin;
+    uint32_t outsz;
+    uint32_t nmsgs;
+    uint32_t len;            /* payload length */
+};
+
+struct rpcout_hdr {
+    int32_t ret;
+    uint32_t len;            /* payload length */
+};
+
+static inline hg_return_t hg_proc_rpcin_z(hg_proc_t proc, void *data) {
+    rpcin_t *in = (rpcin_t *)data;
+    struct rpcin_hdr hdr;
+    char *cp;
+    hg_return_t ret;
+
+    switch (hg_proc_get_op(proc)) {
+    case HG_ENCODE:
+        hdr.ret = in->ret;
+        hdr.origin = in->origin;
+        hdr.outsz = in->outsz;
+        hdr.nmsgs = in->nmsgs;
+        hdr.len = in->data.len;
+        cp = (char *)hg_proc_save_ptr(proc, sizeof(hdr) + hdr.len);
+        if (cp == NULL)
+            return(HG_SIZE_ERROR);
+        memcpy(cp, &hdr, sizeof(hdr));
+        if (hdr.len)
+            memcpy(cp + sizeof(hdr), in->data.buf, hdr.len);
+        return(hg_proc_restore_ptr(proc, cp, sizeof(hdr) + hdr.len));
+    case HG_DECODE:
+        cp = (char *)hg_proc_save_ptr(proc, sizeof(hdr));
+        if (cp == NULL)
+            return(HG_SIZE_ERROR);
+        memcpy(&hdr, cp, sizeof(hdr));
+        if ((ret = hg_proc_restore_ptr(proc, cp, sizeof(hdr))) != HG_SUCCESS)
+            return(ret);
+        in->ret = hdr.ret;
+        in->origin = hdr.origin;
+        in->outsz = hdr.outsz;
+        in->nmsgs = hdr.nmsgs;
+        in->data.len = hdr.len;
+        in->data.buf = (hdr.len) ? hg_proc_save_ptr(proc, hdr.len) : NULL;
+        if (hdr.len == 0)
+            return(HG_SUCCESS);
+        if (in->data.buf == NULL)
+            return(HG_SIZE_ERROR);
+        /* the payload stays in mercury's buffer, we just point at it */
+        return(hg_proc_restore_ptr(proc, in->data.buf, hdr.len));
+    default:       /* HG_FREE: the payload belongs to mercury */
+        return(HG_SUCCESS);
+    }
+}
+
+static inline hg_return_t hg_proc_rpcout_z(hg_proc_t proc, void *data) {
+    rpcout_t *out = (rpcout_t *)data;
+    struct rpcout_hdr hdr;
+    char *cp;
+    hg_return_t ret;
+
+    switch (hg_proc_get_op(proc)) {
+    case HG_ENCODE:
+        hdr.ret = out->ret;
+        hdr.len = out->data.len;
+        cp = (char *)hg_proc_save_ptr(proc, sizeof(hdr) + hdr.len);
+        if (cp == NULL)
+            return(HG_SIZE_ERROR);
+        memcpy(cp, &hdr, sizeof(hdr));
+        if (hdr.len)
+            memcpy(cp + sizeof(hdr), out->data.buf, hdr.len);
+        return(hg_proc_restore_ptr(proc, cp, sizeof(hdr) + hdr.len));
+    case HG_DECODE:
+        cp = (char *)hg_proc_save_ptr(proc, sizeof(hdr));
+        if (cp == NULL)
+            return(HG_SIZE_ERROR);
+        memcpy(&hdr, cp, sizeof(hdr));
+        if ((ret = hg_proc_restore_ptr(proc, cp, sizeof(hdr))) != HG_SUCCESS)
+            return(ret);
+        out->ret = hdr.ret;
+        out->data.len = hdr.len;
+        out->data.buf = (hdr.len) ? hg_proc_save_ptr(proc, hdr.len) : NULL;
+        if (hdr.len == 0)
+            return(HG_SUCCESS);
+        if (out->data.buf == NULL)
+            return(HG_SIZE_ERROR);
+        /* the payload stays in mercury's buffer, we just point at it */
+        return(hg_proc_restore_ptr(proc, out->data.buf, hdr.len));
+    default:       /* HG_FREE: the payload belongs to mercury */
+        return(HG_SUCCESS);
+    }
+}
+
+/*
+ * bulk mode RPC: the client registers a buffer, sends its bulk handle,
+ * and the server moves "size" bytes with HG_Bulk_transfer() before it
+ * replies.  "op" says which way the data goes.
+ */
+#define BULKOP_PULL 1        /* server pulls from client (client->server) */
+#define BULKOP_PUSH 2        /* server pushes to client (server->client) */
+
+MERCURY_GEN_PROC(bulkin_t, ((int32_t)(ret))((int32_t)(origin))
+                           ((int32_t)(op))((uint64_t)(size))
+                           ((hg_bulk_t)(bulk)))
+MERCURY_GEN_PROC(bulkout_t, ((int32_t)(ret)))
+
+/*
+ * ready RPC: the client pings each server instance with this until it
+ * answers, so it knows the server is up before it starts sending.  the
+ * input is the client's instance number and the server replies with
+ * the client instance's origin number.  the done and shutdown RPCs use
+ * the same structure (the client's instance number in both directions).
+ */
+MERCURY_GEN_PROC(ready_t, ((int32_t)(ret)))
+
+#endif /* SNDRCV_RPC_H */
@@ -5,13 +5,123 @@
 
 /*
  * this program contains a mercury RPC server that receives and
- * responds to "count" number of RPC requests and then exits.
+ * responds to RPC requests until the client tells it that it is done
+ * (with a "done" RPC, "d%d", sent to each instance) and then exits.
+ * so the server does not need to know how many RPCs the client is
+ * going to send (or for how long).
  *
  * the program can run multiple instances of the mercury server
  * in the same process.   listening port numbers are assigned
  * sequentially starting at BASEPORT (defined below as 19900).
  * (the address spec uses a printf "%d" to fill the port number...)
  *
+ * each reply carries a payload of the size requested by the client
+ * (see INSIZE/OUTSIZE in sndrcv-client.cc).
+ *
+ * each instance also registers a zero-copy version of its RPC ("z%d")
+ * that uses hand-written procs (see sndrcv-rpc.h) instead of the ones
+ * from MERCURY_GEN_PROC, so the handler reads the request payload in
+ * place in mercury's buffer (see ZEROCOPY in sndrcv-client.cc).  we
+ * keep a separate decode histogram for these RPCs.
+ *
+ * each instance also registers a bulk RPC ("b%d").  for these we
+ * HG_Bulk_transfer() the client's buffer (pull or push, as the client
+ * asks) before we respond, and we print a histogram of the bulk transfer
+ * times at the end of the run.
+ *
+ * the network thread normally blocks in HG_Progress() for up to 100ms
+ * when there is nothing to do.  setenv "PROGRESS" to "busy" to poll
+ * with a zero timeout instead, or to "spin:N" to poll for N usec before
+ * blocking.  each instance prints the CPU time its network thread used
+ * per RPC at the end of the run.
+ *
+ * each instance keeps counters and histograms of where the time goes
+ * on the server side of an RPC:
+ *  - queueing: from the return of the HG_Progress() call that surfaced
+ *    the RPC to the entry of its handler (i.e. the progress/trigger
+ *    handoff, including other callbacks run before it)
+ *  - decode: the time HG_Get_input() takes
+ *  - respond: from HG_Respond() to its reply_sent_cb() callback
+ *  - trigger batch: the number of callbacks each HG_Trigger() drain loop
+ *    runs (we also count progress calls, and how many found work)
+ * these are printed when the instance exits.  setenv "STATS_INTERVAL"
+ * to a number of seconds to also print them (for just that interval)
+ * periodically.
+ *
+ * normally the handlers run in the network thread (from HG_Trigger()),
+ * so any work they do holds up progress for all other RPCs.  setenv
+ * "WORK" to a number of usec to make each RPC handler spin for that long
+ * (synthetic work).  setenv "WORKERS" to a number of threads to start a
+ * pool of worker threads for each instance: the handler then just
+ * queues the RPC on a lock-free queue and a worker decodes it, does the
+ * work, and calls HG_Respond().  we add a histogram of the time RPCs
+ * wait in the queue.  workers pass their timings back in the sentreq
+ * and reply_sent_cb() (in the network thread) records them, so the
+ * counters are still only updated by one thread.  bulk, ready, and done
+ * RPCs are always handled in the network thread.
+ *
+ * setenv "AFFINITY" to pin each instance's threads to cpus (see
+ * sndrcv-client.cc for the presets).  the server's handlers run in the
+ * network thread.  worker threads (if any) are not pinned.
+ *
+ * normally each instance has its own mercury class (HG_Init) and
+ * context, so it has its own NA endpoint and listening port.  if you
+ * setenv "SHAREDCLASS" we instead HG_Init one class on BASEPORT and
+ * give each instance its own context of that class (created with
+ * HG_Context_create_id()) driven by the instance's own network thread.
+ * the client must be run with SHAREDCLASS too.  in this mode an RPC may
+ * arrive on any instance's context, so we count it against the instance
+ * whose context received it and all instances run until every client
+ * instance has sent its done RPC.
+ *
+ * the instances normally run as threads of one process.  setenv "FORK"
+ * to run each instance in its own child process instead (see FORK in
+ * sndrcv-client.cc).  each instance's counters are kept in a shared
+ * memory segment, so main can still print and record the totals.  each
+ * instance process has its own origin table, so main does not combine
+ * the per-origin stats.  FORK does not work with SHAREDCLASS or PERSIST.
+ *
+ * each instance also answers "ready" RPCs ("r%d") from the client.  the
+ * client pings us with these at startup to find out when we are up.
+ * they are not counted as part of the run.
+ *
+ * rather than limiting the whole run to a fixed time, we exit if no
+ * RPCs arrive for TIMEOUT seconds (so we don't hang forever if the
+ * client dies, but long runs are not killed).  in sndrcv-loop the
+ * client's alarm covers both sides, so we don't set one.
+ *
+ * setenv "PERSIST" to run as a long-lived server that any number of
+ * clients (each with any number of instances) can use, one after
+ * another or all at once.  done RPCs are then just noted and there is
+ * no idle timeout.  we stop on SIGINT or SIGTERM, or when a client
+ * sends a shutdown RPC ("s%d", see SHUTDOWN in sndrcv-client.cc).  on
+ * stop each instance waits up to DRAIN_WAIT seconds for the replies it
+ * owes to be sent.
+ *
+ * each client instance is an "origin": its ready RPC registers the
+ * sender's address and client instance number in a table and the
+ * reply gives it an origin number, which it puts in all of its RPCs.
+ * we keep a count, throughput, and service time (handler entry to
+ * reply sent) histogram per origin.  these are printed with the other
+ * stats when an instance has served more than one origin (or in
+ * PERSIST mode), and at the end main prints them combined over all
+ * instances along with the aggregate for the whole server.
+ *
+ * a client running with BATCH packs several logical messages into each
+ * RPC.  the handler walks the records in the payload (and exits if they
+ * don't add up), and we count each message: we keep a histogram of the
+ * messages per RPC and a message count and rate per origin.
+ *
+ * setenv "BIDIR" (on both the server and the client) to send traffic
+ * both ways.  for each RPC we serve we also send an RPC ("v%d") back to
+ * the client instance that sent it, on the same context, before we
+ * respond.  it carries the same payload and asks for the same reply
+ * size.  each instance prints the count, ops/sec, and latency of these
+ * reverse RPCs and main prints them for all instances.  we hold back
+ * the reply to a client instance's done RPC until the reverse RPCs to
+ * it have completed, so it keeps making progress until then.  BIDIR
+ * does not work with WORKERS or FORK.
+ *
  * usage: ./sndrcv-srvr n-instances local-addr-spec
  *
  * example:
@@ -27,25 +137,168 @@
 #include <err.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/types.h>
 
 #include <mercury.h>
 #include <mercury_macros.h>
 
+#include "sndrcv-rpc.h"
+#include "sndrcv-util.h"
+
 #define BASEPORT 19900   /* starting TCP port we listen on (instance 0) */
-#define DEF_COUNT 5      /* default number of msgs to send and recv in a run */
-#define TIMEOUT 120      /* set alarm time (seconds) */
+#define TIMEOUT 120      /* max secs to wait without any RPCs (alarm) */
+#define WORKQ_SIZE 4096  /* max # of RPCs queued for an instance's workers */
+#define WORKER_SPIN 50   /* usec an idle worker polls before it sleeps */
+#define MAXORIGINS 1024  /* max # of client instances we track */
+#define DRAIN_WAIT 2     /* secs to wait for owed replies when stopping */
 
 /*
  * g: shared global data
  */
 struct g {
+    int ninst;               /* from the cmd line */
     char *serverspec;        /* from the cmd line */
-    int count;               /* number of msgs to recv in a run */
     int quiet;               /* quiet mode */
+    struct progress_policy prog;  /* how network threads call progress */
+    struct affinity_plan aff;     /* where to pin our threads */
+    int shared;              /* all instances share one class */
+    hg_class_t *hgclass;     /* the shared class (shared mode only) */
+    pthread_mutex_t reglock; /* serializes RPC registration in shared mode */
+    int fork;                /* run each instance in its own process */
+    int ndone;               /* done RPCs got by all instances (atomic) */
+    FILE *results;           /* results file (NULL=none) */
+    const char *tag;         /* label for result records */
+    char transport[64];      /* transport name (for result records) */
+    int statsint;            /* secs between stats dumps (0=only at end) */
+    int work;                /* synthetic work per RPC (usec) */
+    int nworkers;            /* worker threads per instance (0=none) */
+    int persist;             /* long-lived multi-client server */
+    int stop;                /* set to stop a PERSIST server (atomic) */
+    struct origin *origins;  /* origin table (MAXORIGINS entries) */
+    int norigins;            /* number of origins in the table */
+    pthread_mutex_t origlock;  /* protects the origin table */
+    struct peertab *peers;   /* publish our addresses here (sndrcv-loop) */
+    int bidir;               /* send reverse RPCs to the clients too */
+    int *revout;             /* reverse RPCs in flight per origin (atomic) */
+    struct donepend *donepend;  /* held back done RPC per origin (BIDIR) */
 } g;
 
+/*
+ * origin: a client instance that sends to us (set up by its ready RPC)
+ */
+struct origin {
+    char addr[128];          /* the client's address */
+    int inst;                /* the client's instance number */
+};
+
+/*
+ * origstats: an instance's stats for the RPCs from one origin
+ */
+struct origstats {
+    uint64_t nrpcs;          /* number of RPCs */
+    uint64_t nmsgs;          /* number of logical messages (BATCH) */
+    uint64_t first;          /* time the first one arrived */
+    uint64_t last;           /* time the last reply was sent */
+    struct hist svc;         /* handler entry -> reply sent (nsec) */
+};
+
+/*
+ * revpeer: where an instance sends reverse RPCs for an origin (BIDIR).
+ * set up the first time the instance serves an RPC from the origin.
+ */
+struct revpeer {
+    hg_addr_t addr;          /* the client's address (dup'd, NULL=unset) */
+    hg_id_t id;              /* the client instance's reverse RPC ("v%d") */
+    int inst;                /* the client's instance number */
+};
+
+/*
+ * revreq: state for a reverse RPC in flight, passed as the arg to
+ * rev_cb().  we keep used ones on a per-instance free list.
+ */
+struct revreq {
+    struct revreq *next;     /* next on free list */
+    int n;                   /* instance that sent it */
+    int origin;              /* origin it went to */
+    uint64_t start;          /* time HG_Forward was called */
+};
+
+/*
+ * donepend: a done RPC we have not answered yet because reverse RPCs
+ * to its origin are still in flight (BIDIR).  whoever takes the handle
+ * (with an atomic exchange) sends the reply.
+ */
+struct donepend {
+    hg_handle_t handle;      /* the done RPC (NULL=none, atomic) */
+    int *np;                 /* instance that got it */
+    int cinst;               /* the client's instance number */
+};
+
+/*
+ * bulkmem: a local bulk buffer and its registration.  when a bigger
+ * transfer comes in we replace the instance's buffer, but transfers
+ * started before that may still be using the old one, so each buffer
+ * counts its transfers and the last one to finish frees a replaced
+ * buffer (see bulkmem_put()).
+ */
+struct bulkmem {
+    char *buf;               /* the buffer */
+    hg_size_t size;          /* size of buf */
+    hg_bulk_t hand;          /* bulk handle for buf */
+    int users;               /* transfers using it */
+};
+
+/*
+ * srvstats: server side hot path counters and histograms
+ */
+struct srvstats {
+    uint64_t nprogress;      /* number of progress() calls */
+    uint64_t nprogwork;      /* ... that returned with work to trigger */
+    uint64_t ndrains;        /* trigger drain loops that ran callbacks */
+    uint64_t ncallbacks;     /* callbacks run by HG_Trigger() */
+    struct hist queue;       /* progress return -> handler entry (nsec) */
+    struct hist decode;      /* HG_Get_input() time (nsec) */
+    struct hist zdecode;     /* ... for zero-copy RPCs (nsec) */
+    struct hist respond;     /* HG_Respond() -> reply_sent_cb() (nsec) */
+    struct hist wqwait;      /* time waiting in worker queue (nsec) */
+    struct hist batch;       /* callbacks per trigger drain loop */
+    struct hist msgs;        /* logical messages per batched RPC */
+};
+
+/*
+ * sentreq: state for a reply while HG_Respond() is in progress, passed
+ * as the arg to reply_sent_cb().  we keep used ones on a per-instance
+ * free list so that the reply path doesn't malloc.
+ */
+struct sentreq {
+    struct sentreq *next;    /* next on free list */
+    int *np;                 /* instance number */
+    hg_handle_t handle;      /* RPC handle */
+    uint64_t queued;         /* time queued for a worker (0=not queued) */
+    uint64_t wqwait;         /* time spent in the worker queue */
+    uint64_t decode;         /* time HG_Get_input took */
+    uint64_t start;          /* time HG_Respond was called */
+    uint64_t arrive;         /* time the handler was called */
+    int origin;              /* origin number from the RPC (-1=unknown) */
+    int nmsgs;               /* logical messages in it (0=not batched) */
+    int zcopy;               /* RPC uses the zero-copy procs */
+};
+
+/*
+ * worker: a worker thread in an instance's worker pool
+ */
+struct worker {
+    int n;                   /* instance we work for */
+    pthread_t thread;        /* our thread */
+    char *replybuf;          /* reply payload buffer */
+    int replybufsz;          /* size of replybuf */
+};
+
 /*
  * is: per-instance state structure.   we malloc an array of these at
  * startup.
@@ -55,19 +308,77 @@ struct is {
     hg_class_t *hgclass;     /* class for this instance */
     hg_context_t *hgctx;     /* context for this instance */
     hg_id_t myrpcid;         /* the ID of the instance's RPC */
+    hg_id_t myzid;           /* the ID of the instance's zero-copy RPC */
+    hg_id_t mybulkid;        /* the ID of the instance's bulk RPC */
+    hg_id_t myreadyid;       /* the ID of the instance's ready RPC */
+    hg_id_t mydoneid;        /* the ID of the instance's done RPC */
+    hg_id_t myshutid;        /* the ID of the instance's shutdown RPC */
     pthread_t sthread;       /* server thread */
     char myid[256];          /* my local merc address */
     char myfun[64];          /* my function name */
+    char myzfun[64];         /* my zero-copy function name */
+    char mybulkfun[64];      /* my bulk function name */
+    char myreadyfun[64];     /* my ready function name */
+    char mydonefun[64];      /* my done function name */
+    char myshutfun[64];      /* my shutdown function name */
     int got;                 /* number of RPCs server has got */
+    int done;                /* set when the client's done RPC is sent */
+    uint64_t cpu;            /* cpu time used by the network thread */
+
+    /* only used by the network thread (and the callbacks it runs) */
+    uint64_t progret;        /* time the last progress call returned */
+    struct srvstats st;      /* stats since the last dump */
+    struct srvstats sttot;   /* stats for the run, up to the last dump */
+    uint64_t first;          /* time the first RPC arrived */
+    uint64_t last;           /* time the last reply was sent */
+    struct sentreq *freesr;  /* free list of sentreqs */
+    int inflight;            /* RPCs we still owe a reply */
+    struct revpeer *rev;     /* per origin reverse RPC target (BIDIR) */
+    struct revreq *freerev;  /* free list of revreqs */
+    int revinflight;         /* reverse RPCs not completed yet */
+    uint64_t nrev;           /* reverse RPCs completed */
+    uint64_t revfirst;       /* time the first one was sent */
+    uint64_t revlast;        /* time the last one completed */
+    struct hist revlat;      /* reverse RPC latency (nsec) */
+    uint64_t stopat;         /* time we saw g.stop (PERSIST) */
+    struct origstats *orig[MAXORIGINS];     /* per origin, since last dump */
+    struct origstats *origtot[MAXORIGINS];  /* per origin, for the run */
+
+    /* worker pool (WORKERS only) */
+    struct worker *workers;  /* array of g.nworkers workers */
+    struct workq wq;         /* queue of sentreqs for the workers */
+    pthread_mutex_t wqlock;  /* for sleeping workers */
+    pthread_cond_t wqcond;   /* sleeping workers wait on this */
+    int wqsleepers;          /* number of sleeping workers (atomic) */
+    int wqstop;              /* tell workers to exit - wqlock protects */
+    char *replybuf;          /* reply payload buffer */
+    int replybufsz;          /* size of replybuf */
+
+    /*
+     * bulk mode: all transfers for an instance share one local buffer
+     * (replaced by a bigger one as needed, see bulkmem).  the contents
+     * are never checked, so concurrent transfers that overlap in the
+     * buffer are harmless.
+     */
+    struct bulkmem *bulk;    /* local bulk buffer (NULL=none yet) */
+    struct hist bulklat;     /* bulk transfer time histogram */
+    uint64_t bulkbytes;      /* total bytes moved by bulk transfers */
     int quiet;               /* quiet mode */
 };
 struct is *is;    /* an array of state */
 
 /*
- * input and output structures (this also generates XDR fns using boost pp)
+ * bulkreq: state for a bulk RPC while its transfer is in progress
  */
-MERCURY_GEN_PROC(rpcin_t, ((int32_t)(ret)))
-MERCURY_GEN_PROC(rpcout_t, ((int32_t)(ret)))
+struct bulkreq {
+    int *np;                 /* instance number */
+    hg_handle_t handle;      /* RPC handle to respond to */
+    bulkin_t in;             /* decoded input (holds origin bulk handle) */
+    uint64_t decode;         /* time spent in HG_Get_input (nsec) */
+    uint64_t arrive;         /* time the handler was called */
+    uint64_t start;          /* time transfer was started */
+    struct bulkmem *mem;     /* local buffer the transfer uses */
+};
 
 /*
  * forward prototypes here, so we can structure the source code to
@@ -75,8 +386,38 @@ MERCURY_GEN_PROC(rpcout_t, ((int32_t)(ret)))
  */
 static void *run_instance(void *arg);   /* run one instance */
 static void *run_network(void *arg);    /* per-instance network thread */
+static int recvs_done(int n);           /* done receiving? */
+static int *handle_instance(hg_handle_t handle);  /* get n from handle */
 static hg_return_t rpchandler(hg_handle_t handle); /* server cb */
+static hg_return_t bulkhandler(hg_handle_t handle); /* server cb */
+static void bulkmem_put(int n, struct bulkmem *bm);  /* transfer done */
+static hg_return_t bulk_done_cb(const struct hg_cb_info *cbi); /* server cb */
 static hg_return_t reply_sent_cb(const struct hg_cb_info *cbi);  /* server cb */
+static hg_return_t readyhandler(hg_handle_t handle); /* server cb */
+static hg_return_t ready_sent_cb(const struct hg_cb_info *cbi); /* server cb */
+static hg_return_t donehandler(hg_handle_t handle); /* server cb */
+static hg_return_t done_sent_cb(const struct hg_cb_info *cbi); /* server cb */
+static hg_return_t shuthandler(hg_handle_t handle);  /* server cb */
+static hg_return_t shut_sent_cb(const struct hg_cb_info *cbi); /* server cb */
+static int origin_get(hg_handle_t handle, int cinst);  /* origin number */
+static void origin_account(int n, struct sentreq *sr, uint64_t now);
+static void origin_dump(int n, int final);  /* print per origin stats */
+static void origin_print(const char *tag, int o, const struct origstats *os);
+static void stop_handler(int sig);      /* SIGINT/SIGTERM (PERSIST) */
+static void stats_dump(int n, int final);  /* print and reset is[n].st */
+static struct sentreq *sentreq_get(int n, int *np);  /* alloc a sentreq */
+static void serve_rpc(int n, struct sentreq *sr, char **bufp,
+                      int *bufszp);     /* decode, work, and respond */
+static int unpack_batch(int n, rpcin_t *in);  /* walk batched messages */
+static void *run_worker(void *arg);     /* worker pool thread */
+static struct sentreq *worker_wait(int n);  /* wait for work */
+static void srvr_record(int instance, uint64_t nrpcs, uint64_t nsec,
+                        uint64_t cpu, const struct hist *lat, uint64_t bytes,
+                        double revops);  /* write results record */
+static void rev_send(int n, hg_handle_t handle,
+                     rpcin_t *in);      /* send a reverse RPC (BIDIR) */
+static hg_return_t rev_cb(const struct hg_cb_info *cbi);  /* client cb */
+static void done_release(int o);        /* answer a held back done RPC */
 
 /*
  * main program.  usage:
@@ -88,30 +429,97 @@ static hg_return_t reply_sent_cb(const struct hg_cb_info *cbi);  /* server cb */
 int main(int argc, char **argv) {
     int n, lcv, rv;
     pthread_t *tarr;
+    pid_t *pids;
+    size_t shmsz;
     char *c;
     if (argc != 3) 
         errx(0, "usage: %s n-instances local-addr-spec", *argv);
 
-    alarm(TIMEOUT);   /* so we don't hang forever */
-    n = atoi(argv[1]);
+    /*
+     * so we don't hang forever (rearmed as RPCs arrive).  in sndrcv-loop
+     * the client shares our process and its alarm, so we leave it alone.
+     */
+    if (!g.peers)
+        alarm(TIMEOUT);
+    g.ninst = n = atoi(argv[1]);
     g.serverspec = argv[2];
-    if ((c = getenv("COUNT")) != NULL && (rv = atoi(c)) > 0) {
-        g.count = rv;
-    } else {
-        g.count = DEF_COUNT;
-    }
     g.quiet = (getenv("QUIET") != NULL);
+    progress_parse(getenv("PROGRESS"), &g.prog);
+    affinity_parse(getenv("AFFINITY"), g.ninst, &g.aff);
+    g.shared = (getenv("SHAREDCLASS") != NULL);
+    g.results = results_open(getenv("RESULTS"));
+    if ((c = getenv("STATS_INTERVAL")) != NULL)
+        g.statsint = atoi(c);
+    if ((c = getenv("WORK")) != NULL)
+        g.work = atoi(c);
+    if ((c = getenv("WORKERS")) != NULL)
+        g.nworkers = atoi(c);
+    g.persist = (getenv("PERSIST") != NULL);
+    g.fork = (getenv("FORK") != NULL);
+    if (g.fork && (g.shared || g.persist || g.peers))
+        errx(1, "FORK does not work with SHAREDCLASS, PERSIST, or in "
+             "sndrcv-loop");
+    g.bidir = (getenv("BIDIR") != NULL);
+    if (g.bidir && (g.fork || g.nworkers))
+        errx(1, "BIDIR does not work with FORK or WORKERS");
+    if (g.bidir) {
+        g.revout = (int *)calloc(MAXORIGINS, sizeof(*g.revout));
+        g.donepend = (struct donepend *)calloc(MAXORIGINS,
+                                               sizeof(*g.donepend));
+        if (!g.revout || !g.donepend) errx(1, "malloc bidir state failed");
+    }
+    if (g.persist) {     /* run until told to stop */
+        if (!g.peers)
+            alarm(0);
+        signal(SIGINT, stop_handler);
+        signal(SIGTERM, stop_handler);
+    }
+    g.origins = (struct origin *)malloc(MAXORIGINS * sizeof(*g.origins));
+    if (!g.origins) errx(1, "malloc origins failed");
+    if (pthread_mutex_init(&g.origlock, NULL) != 0)
+        errx(1, "origlock init");
+    g.tag = getenv("RESULTS_TAG");
+    transport_name(g.serverspec, g.transport, sizeof(g.transport));
 
-    printf("main: starting %d ...\n", n);
+    printf("main: starting %d ... (progress=%s, %s class, affinity=%s)\n",
+           n, progress_name(&g.prog), (g.fork) ? "per-process" :
+           ((g.shared) ? "shared" : "per-instance"), affinity_name(&g.aff));
+    printf("main: %d worker threads per instance, work = %d usec/rpc\n",
+           g.nworkers, g.work);
+    if (g.persist)
+        printf("main: persistent server, stop with SIGINT/SIGTERM or a "
+               "shutdown RPC\n");
+    if (g.bidir)
+        printf("main: bidirectional, each RPC served sends one back\n");
     tarr = (pthread_t *)malloc(n * sizeof(pthread_t));
-    if (!tarr) errx(1, "malloc tarr failed");
-    is = (struct is *)malloc(n *sizeof(*is));    /* array */
-    if (!is) errx(1, "malloc is failed");
-    memset(is, 0, n * sizeof(*is));
+    pids = (pid_t *)malloc(n * sizeof(pid_t));
+    if (!tarr || !pids) errx(1, "malloc tarr failed");
+    if (g.fork) {    /* main reads the instances' counters from is */
+        shmsz = n * (sizeof(*is) + 128) + 4096;
+        shm_init(shmsz);
+        printf("main: each instance runs in its own process (%zu byte "
+               "shared segment)\n", shmsz);
+    }
+    is = (struct is *)shm_alloc(n * sizeof(*is));    /* array */
+
+    if (g.shared) {   /* one class for everyone, listening on BASEPORT */
+        char myid[256];
+        snprintf(myid, sizeof(myid), g.serverspec, BASEPORT);
+        printf("main: attempt to init shared class %s\n", myid);
+        g.hgclass = HG_Init(myid, HG_TRUE);
+        if (g.hgclass == NULL)  errx(1, "HG_init failed");
+        if (pthread_mutex_init(&g.reglock, NULL) != 0)
+            errx(1, "reglock init");
+        if (g.peers) peertab_publish(g.peers, 0, g.hgclass);
+    }
 
-    /* fork off a thread for each instance */
+    /* fork off a thread (or a process) for each instance */
     for (lcv = 0 ; lcv < n ; lcv++) {
         is[lcv].n = lcv;
+        if (g.fork) {
+            pids[lcv] = fork_instance(run_instance, (void*)&is[lcv]);
+            continue;
+        }
         rv = pthread_create(&tarr[lcv], NULL, run_instance, (void*)&is[lcv]);
         if (rv != 0) {
             printf("pthread create failed %d\n", rv);
@@ -121,12 +529,84 @@ int main(int argc, char **argv) {
 
     /* now wait for everything to finish */
     printf("main: collecting\n");
-    for (lcv = 0 ; lcv < n ; lcv++) {
-        pthread_join(tarr[lcv], NULL);
+    if (g.fork) {
+        alarm(0);    /* the instance processes have their own alarms */
+        if ((rv = wait_instances(pids, n)) != 0)
+            errx(1, "%d instance processes failed", rv);
+    } else {
+        for (lcv = 0 ; lcv < n ; lcv++) {
+            pthread_join(tarr[lcv], NULL);
+        }
     }
     printf("main: collection done\n");
+    if (!g.fork)     /* (origtot is in each instance process's memory) */
+        origin_dump(-1, 1);
+    if (g.fork) {       /* the instances' totals (not printed otherwise) */
+        uint64_t got, cpu;
+        for (got = cpu = 0, lcv = 0 ; lcv < n ; lcv++) {
+            got += is[lcv].got;
+            cpu += is[lcv].cpu;
+        }
+        printf("main: all instances: %llu rpcs, cpu nsec/rpc = %llu\n",
+               (unsigned long long)got,
+               (unsigned long long)((got) ? cpu / got : 0));
+    }
+    if (g.bidir) {      /* the reverse direction for all instances */
+        struct hist *all;
+        uint64_t nrev;
+        double revops;
+        all = (struct hist *)malloc(sizeof(*all));
+        if (!all) errx(1, "malloc hist failed");
+        hist_reset(all);
+        for (nrev = 0, revops = 0, lcv = 0 ; lcv < n ; lcv++) {
+            hist_merge(all, &is[lcv].revlat);
+            nrev += is[lcv].nrev;
+            if (is[lcv].revlast > is[lcv].revfirst)
+                revops += is[lcv].nrev * 1e9 /
+                          (is[lcv].revlast - is[lcv].revfirst);
+        }
+        printf("main: all instances: %llu reverse rpcs, ops/sec = %.1f\n",
+               (unsigned long long)nrev, revops);
+        hist_print("main", "all instances reverse rpc latency", all);
+        free(all);
+    }
+    if (g.results) {    /* aggregate record for all instances */
+        struct hist *all;
+        uint64_t got, cpu, bytes, first, last;
+        double revops;
+        all = (struct hist *)malloc(sizeof(*all));
+        if (!all) errx(1, "malloc hist failed");
+        hist_reset(all);
+        for (got = cpu = bytes = first = last = 0,
+             revops = (g.bidir) ? 0 : -1, lcv = 0 ; lcv < n ; lcv++) {
+            hist_merge(all, &is[lcv].bulklat);
+            if (is[lcv].got) {
+                if (got == 0 || is[lcv].first < first)
+                    first = is[lcv].first;
+                if (is[lcv].last > last)
+                    last = is[lcv].last;
+            }
+            got += is[lcv].got;
+            cpu += is[lcv].cpu;
+            bytes += is[lcv].bulkbytes;
+            if (g.bidir && is[lcv].revlast > is[lcv].revfirst)
+                revops += is[lcv].nrev * 1e9 /
+                          (is[lcv].revlast - is[lcv].revfirst);
+        }
+        srvr_record(-1, got, last - first, cpu, all, bytes, revops);
+        free(all);
+        fclose(g.results);
+    }
+    if (g.shared) {
+        HG_Finalize(g.hgclass);
+        pthread_mutex_destroy(&g.reglock);
+    }
+    pthread_mutex_destroy(&g.origlock);
+    free(g.origins);
+    free(g.revout);
+    free(g.donepend);
     
-    exit(0);
+    return(0);
 }
 
 /*
@@ -138,16 +618,36 @@ void *run_instance(void *arg) {
     int n = isp->n;               /* recover n from isp */
     int lcv, rv;
     hg_return_t ret;
+    char tag[32];
+    double revops;
     
+    affinity_pin(g.aff.app[n]);
     printf("%d: instance running\n", n);
+    if (g.aff.mode != AFF_NONE)
+        printf("%d: affinity %s: app thread on cpu %d, network thread on "
+               "cpu %d\n", n, affinity_name(&g.aff), g.aff.app[n],
+               g.aff.net[n]);
     is[n].n = n;
 
-    snprintf(is[n].myid, sizeof(is[n].myid), g.serverspec, n+BASEPORT);
-    printf("%d: attempt to init %s\n", n, is[n].myid);
-    is[n].hgclass = HG_Init(is[n].myid, HG_TRUE);
-    if (is[n].hgclass == NULL)  errx(1, "HG_init failed");
-    is[n].hgctx = HG_Context_create(is[n].hgclass);
-    if (is[n].hgctx == NULL)  errx(1, "HG_Context_create failed");
+    if (g.shared) {
+        snprintf(is[n].myid, sizeof(is[n].myid), g.serverspec, BASEPORT);
+        printf("%d: using shared class, context id %d\n", n, n);
+        is[n].hgclass = g.hgclass;
+        is[n].hgctx = HG_Context_create_id(is[n].hgclass, n);
+        if (is[n].hgctx == NULL)  errx(1, "HG_Context_create_id failed");
+        pthread_mutex_lock(&g.reglock);
+    } else {
+        snprintf(is[n].myid, sizeof(is[n].myid), g.serverspec, n+BASEPORT);
+        printf("%d: attempt to init %s\n", n, is[n].myid);
+        is[n].hgclass = HG_Init(is[n].myid, HG_TRUE);
+        if (is[n].hgclass == NULL)  errx(1, "HG_init failed");
+        is[n].hgctx = HG_Context_create(is[n].hgclass);
+        if (is[n].hgctx == NULL)  errx(1, "HG_Context_create failed");
+        if (g.peers) peertab_publish(g.peers, n, is[n].hgclass);
+    }
+    /* the shared class uses the context's data to find the instance */
+    if (HG_Context_set_data(is[n].hgctx, &is[n].n, NULL) != HG_SUCCESS)
+        errx(1, "unable to set context data");
     
     snprintf(is[n].myfun, sizeof(is[n].myfun), "f%d", n);
     printf("%d: function name is %s\n", n, is[n].myfun);
@@ -157,20 +657,162 @@ void *run_instance(void *arg) {
     /* we use registered data to pass instance number to server callback */
     if (HG_Register_data(is[n].hgclass, is[n].myrpcid, &n, NULL) != HG_SUCCESS)
         errx(1, "unable to register n as data");
+    snprintf(is[n].myzfun, sizeof(is[n].myzfun), "z%d", n);
+    is[n].myzid = HG_Register_name(is[n].hgclass, is[n].myzfun,
+                                   hg_proc_rpcin_z, hg_proc_rpcout_z,
+                                   rpchandler);
+    if (HG_Register_data(is[n].hgclass, is[n].myzid, &n, NULL) != HG_SUCCESS)
+        errx(1, "unable to register n as zero-copy data");
+
+    snprintf(is[n].mybulkfun, sizeof(is[n].mybulkfun), "b%d", n);
+    is[n].mybulkid = HG_Register_name(is[n].hgclass, is[n].mybulkfun,
+                                      hg_proc_bulkin_t, hg_proc_bulkout_t,
+                                      bulkhandler);
+    if (HG_Register_data(is[n].hgclass, is[n].mybulkid, &n,
+                         NULL) != HG_SUCCESS)
+        errx(1, "unable to register n as bulk data");
+
+    snprintf(is[n].myreadyfun, sizeof(is[n].myreadyfun), "r%d", n);
+    is[n].myreadyid = HG_Register_name(is[n].hgclass, is[n].myreadyfun,
+                                       hg_proc_ready_t, hg_proc_ready_t,
+                                       readyhandler);
+    snprintf(is[n].mydonefun, sizeof(is[n].mydonefun), "d%d", n);
+    is[n].mydoneid = HG_Register_name(is[n].hgclass, is[n].mydonefun,
+                                      hg_proc_ready_t, hg_proc_ready_t,
+                                      donehandler);
+    if (HG_Register_data(is[n].hgclass, is[n].mydoneid, &n,
+                         NULL) != HG_SUCCESS)
+        errx(1, "unable to register n as done data");
+    snprintf(is[n].myshutfun, sizeof(is[n].myshutfun), "s%d", n);
+    is[n].myshutid = HG_Register_name(is[n].hgclass, is[n].myshutfun,
+                                      hg_proc_ready_t, hg_proc_ready_t,
+                                      shuthandler);
+    if (g.shared) pthread_mutex_unlock(&g.reglock);
+    hist_reset(&is[n].bulklat);
+    hist_reset(&is[n].revlat);
+    if (g.bidir) {
+        is[n].rev = (struct revpeer *)calloc(MAXORIGINS, sizeof(*is[n].rev));
+        if (!is[n].rev) errx(1, "malloc revpeers failed");
+    }
+    memset(&is[n].st, 0, sizeof(is[n].st));
+    memset(&is[n].sttot, 0, sizeof(is[n].sttot));
+
+    /* start the worker pool (if any) */
+    if (g.nworkers > 0) {
+        workq_init(&is[n].wq, WORKQ_SIZE);
+        if (pthread_mutex_init(&is[n].wqlock, NULL) != 0)
+            errx(1, "wqlock init");
+        if (pthread_cond_init(&is[n].wqcond, NULL) != 0)
+            errx(1, "wqcond init");
+        is[n].workers = (struct worker *)malloc(g.nworkers *
+                                                sizeof(*is[n].workers));
+        if (!is[n].workers) errx(1, "malloc workers failed");
+        memset(is[n].workers, 0, g.nworkers * sizeof(*is[n].workers));
+        for (lcv = 0 ; lcv < g.nworkers ; lcv++) {
+            is[n].workers[lcv].n = n;
+            rv = pthread_create(&is[n].workers[lcv].thread, NULL, run_worker,
+                                &is[n].workers[lcv]);
+            if (rv != 0) errx(1, "pthread create worker failed");
+        }
+    }
 
     /* fork off a progress/trigger thread */
     rv = pthread_create(&is[n].sthread, NULL, run_network, (void*)&n);
     if (rv != 0) errx(1, "pthread create srvr failed");
 
-    /* wait for server to finish recv'ing count msgs and exit */
+    /* wait for the client to tell us it is done and exit */
     printf("%d: init done.  waiting for recvs to complete\n", n);
     pthread_join(is[n].sthread, NULL);
     printf("%d: all recvs complete\n", n);
+    if (g.nworkers > 0) {     /* the queue is empty now, stop the workers */
+        pthread_mutex_lock(&is[n].wqlock);
+        is[n].wqstop = 1;
+        pthread_cond_broadcast(&is[n].wqcond);
+        pthread_mutex_unlock(&is[n].wqlock);
+        for (lcv = 0 ; lcv < g.nworkers ; lcv++) {
+            pthread_join(is[n].workers[lcv].thread, NULL);
+            free(is[n].workers[lcv].replybuf);
+        }
+        free(is[n].workers);
+        workq_free(&is[n].wq);
+        pthread_cond_destroy(&is[n].wqcond);
+        pthread_mutex_destroy(&is[n].wqlock);
+    }
+    stats_dump(n, 1);
+    for (lcv = 0 ; lcv < MAXORIGINS ; lcv++)
+        free(is[n].orig[lcv]);      /* origtot is freed by origin_dump */
+    while (is[n].freesr) {
+        struct sentreq *sr = is[n].freesr;
+        is[n].freesr = sr->next;
+        free(sr);
+    }
+    if (is[n].bulklat.cnt) {
+        snprintf(tag, sizeof(tag), "%d", n);
+        hist_print(tag, "bulk transfer", &is[n].bulklat);
+        printf("%d: bulk per-transfer MB/s = %.3f\n", n,
+               (double)is[n].bulkbytes * 1e3 / is[n].bulklat.sum);
+    }
+    if (g.bidir) {
+        snprintf(tag, sizeof(tag), "%d", n);
+        printf("%d: %llu reverse rpcs, ops/sec = %.1f\n", n,
+               (unsigned long long)is[n].nrev,
+               (is[n].revlast > is[n].revfirst) ? is[n].nrev * 1e9 /
+               (is[n].revlast - is[n].revfirst) : 0.0);
+        hist_print(tag, "reverse rpc latency", &is[n].revlat);
+        for (lcv = 0 ; lcv < MAXORIGINS ; lcv++) {
+            if (is[n].rev[lcv].addr)
+                HG_Addr_free(is[n].hgclass, is[n].rev[lcv].addr);
+        }
+        free(is[n].rev);
+        is[n].rev = NULL;
+        while (is[n].freerev) {
+            struct revreq *rq = is[n].freerev;
+            is[n].freerev = rq->next;
+            free(rq);
+        }
+    }
+    revops = -1;        /* reverse RPCs/sec (BIDIR only) */
+    if (g.bidir)
+        revops = (is[n].revlast > is[n].revfirst) ?
+                 is[n].nrev * 1e9 / (is[n].revlast - is[n].revfirst) : 0;
+    srvr_record(n, is[n].got, is[n].last - is[n].first, is[n].cpu,
+                &is[n].bulklat, is[n].bulkbytes, revops);
+    if (is[n].bulk) {    /* all transfers are done by now */
+        HG_Bulk_free(is[n].bulk->hand);
+        free(is[n].bulk->buf);
+        free(is[n].bulk);
+    }
+    free(is[n].replybuf);
     HG_Context_destroy(is[n].hgctx);
-    HG_Finalize(is[n].hgclass);
+    if (!g.shared) HG_Finalize(is[n].hgclass);
     printf("%d: instance done\n", n);
 }
 
+/*
+ * recvs_done: return non-zero if instance n's client is done sending.
+ * with a shared class, a done RPC can land on any context so we wait
+ * until all the client instances are done.  a PERSIST server is done
+ * when it has been told to stop and it has sent the replies it owes
+ * (or DRAIN_WAIT has passed).  with BIDIR we also wait for our reverse
+ * RPCs to complete.
+ */
+static int recvs_done(int n) {
+    if (is[n].revinflight)
+        return(0);
+    if (g.persist) {
+        if (!__atomic_load_n(&g.stop, __ATOMIC_RELAXED))
+            return(0);
+        if (is[n].inflight == 0)
+            return(1);
+        if (is[n].stopat == 0)
+            is[n].stopat = now_ns();
+        return(now_ns() - is[n].stopat > DRAIN_WAIT * 1000000000ULL);
+    }
+    if (g.shared)
+        return(__atomic_load_n(&g.ndone, __ATOMIC_RELAXED) >= g.ninst);
+    return(is[n].done);
+}
+
 /*
  * run_network: network support pthread.   need to call progress to push the
  * network and then trigger to run the callback.  we do this all in 
@@ -183,54 +825,734 @@ static void *run_network(void *arg) {
     int n = *((int *)arg);
     unsigned int actual; 
     hg_return_t ret;
+    uint64_t cpu, now, lastarm, laststats, ncb;
+    int lastgot;
     is[n].got = actual = 0;
+    lastgot = 0;
+    lastarm = laststats = now_ns();
 
+    affinity_pin(g.aff.net[n]);
     printf("%d: network thread running\n", n);
     /* while (not done sending or not done recving */
-    while (is[n].got < g.count) {
+    while (!recvs_done(n)) {
 
+        ncb = 0;
         do {
             ret = HG_Trigger(is[n].hgctx, 0, 1, &actual);
+            if (ret == HG_SUCCESS) ncb += actual;
         } while (ret == HG_SUCCESS && actual);
+        if (ncb) {
+            is[n].st.ndrains++;
+            is[n].st.ncallbacks += ncb;
+            hist_record(&is[n].st.batch, ncb);
+        }
 
         /* recheck, since trigger can change is[n].got */
-        if (is[n].got < g.count) {
-            HG_Progress(is[n].hgctx, 100);
+        if (!recvs_done(n)) {
+            is[n].st.nprogress++;
+            if (progress(is[n].hgctx, &g.prog) == HG_SUCCESS) {
+                is[n].progret = now_ns();   /* handlers measure from here */
+                is[n].st.nprogwork++;
+            }
+        }
+
+        /*
+         * push the alarm back (at most once a second) while RPCs arrive
+         * (not in sndrcv-loop, where the client owns the alarm)
+         */
+        if (is[n].got != lastgot && !g.persist && !g.peers) {
+            lastgot = is[n].got;
+            now = now_ns();
+            if (now - lastarm > 1000000000ULL) {
+                alarm(TIMEOUT);
+                lastarm = now;
+            }
+        }
+
+        if (g.statsint &&
+            now_ns() - laststats >= (uint64_t)g.statsint * 1000000000ULL) {
+            stats_dump(n, 0);
+            laststats = now_ns();
         }
     }
+    cpu = is[n].cpu = thread_cpu_ns(pthread_self());
+    printf("%d: network thread cpu = %llu nsec, cpu nsec/rpc = %llu "
+           "(%d rpcs)\n", n, (unsigned long long)cpu,
+           (unsigned long long)((is[n].got) ? cpu / is[n].got : 0),
+           is[n].got);
     printf("%d: network thread complete\n", n);
 }
 
+/*
+ * stats_dump: print instance n's server stats since the last dump and
+ * add them to the run totals.  if "final" is set we print the totals
+ * for the whole run instead.
+ */
+static void stats_dump(int n, int final) {
+    struct srvstats *sp;
+    char tag[32];
+
+    sp = &is[n].sttot;
+    sp->nprogress += is[n].st.nprogress;
+    sp->nprogwork += is[n].st.nprogwork;
+    sp->ndrains += is[n].st.ndrains;
+    sp->ncallbacks += is[n].st.ncallbacks;
+    hist_merge(&sp->queue, &is[n].st.queue);
+    hist_merge(&sp->decode, &is[n].st.decode);
+    hist_merge(&sp->zdecode, &is[n].st.zdecode);
+    hist_merge(&sp->respond, &is[n].st.respond);
+    hist_merge(&sp->wqwait, &is[n].st.wqwait);
+    hist_merge(&sp->batch, &is[n].st.batch);
+    hist_merge(&sp->msgs, &is[n].st.msgs);
+    if (!final) sp = &is[n].st;
+
+    snprintf(tag, sizeof(tag), (final) ? "%d" : "%d [interval]", n);
+    printf("%s: progress calls = %llu (%llu with work), trigger drains = "
+           "%llu, callbacks = %llu\n", tag,
+           (unsigned long long)sp->nprogress,
+           (unsigned long long)sp->nprogwork,
+           (unsigned long long)sp->ndrains,
+           (unsigned long long)sp->ncallbacks);
+    hist_print(tag, "progress to handler", &sp->queue);
+    hist_print(tag, "get_input decode", &sp->decode);
+    if (sp->zdecode.cnt)
+        hist_print(tag, "get_input decode (zero-copy)", &sp->zdecode);
+    hist_print(tag, "respond to sent", &sp->respond);
+    if (g.nworkers)
+        hist_print(tag, "worker queue wait", &sp->wqwait);
+    hist_print_unit(tag, "trigger batch", "callbacks", &sp->batch);
+    if (sp->msgs.cnt)
+        hist_print_unit(tag, "messages per rpc", "msgs", &sp->msgs);
+    origin_dump(n, final);
+
+    memset(&is[n].st, 0, sizeof(is[n].st));
+}
+
+/*
+ * origin_dump: print instance n's per origin stats since the last dump
+ * and add them to its run totals (or its run totals, if "final").  if
+ * n is -1 we print the run totals of all instances combined for each
+ * origin and for the server as a whole (and free the run totals).
+ */
+static void origin_dump(int n, int final) {
+    struct origstats *os, *all, *sum;
+    int o, lcv, norig, nused, show;
+    char tag[32];
+
+    if (n >= 0) {
+        for (nused = o = 0 ; o < MAXORIGINS ; o++) {
+            if ((os = is[n].orig[o]) == NULL || os->nrpcs == 0)
+                continue;
+            nused++;
+            if (is[n].origtot[o] == NULL) {
+                is[n].origtot[o] = (struct origstats *)malloc(sizeof(*os));
+                if (!is[n].origtot[o]) errx(1, "malloc origstats failed");
+                memset(is[n].origtot[o], 0, sizeof(*os));
+            }
+            sum = is[n].origtot[o];
+            if (sum->nrpcs == 0 || os->first < sum->first)
+                sum->first = os->first;
+            if (os->last > sum->last) sum->last = os->last;
+            sum->nrpcs += os->nrpcs;
+            sum->nmsgs += os->nmsgs;
+            hist_merge(&sum->svc, &os->svc);
+        }
+        if (final) {
+            for (nused = o = 0 ; o < MAXORIGINS ; o++)
+                if (is[n].origtot[o]) nused++;
+        }
+        if (nused > 1 || g.persist) {   /* i.e. not the usual one client */
+            snprintf(tag, sizeof(tag), (final) ? "%d" : "%d [interval]", n);
+            printf("%s: %d origins\n", tag, nused);
+            for (o = 0 ; o < MAXORIGINS ; o++) {
+                os = (final) ? is[n].origtot[o] : is[n].orig[o];
+                if (os && os->nrpcs)
+                    origin_print(tag, o, os);
+            }
+        }
+        for (o = 0 ; o < MAXORIGINS ; o++) {
+            if (is[n].orig[o])
+                memset(is[n].orig[o], 0, sizeof(*is[n].orig[o]));
+        }
+        return;
+    }
+
+    /*
+     * combine the instances (called from main after they are done).
+     * one client has ninst origins, so only show them if there were
+     * more clients than that.
+     */
+    show = (g.persist || g.norigins > g.ninst);
+    all = (struct origstats *)malloc(sizeof(*all));
+    sum = (struct origstats *)malloc(sizeof(*sum));
+    if (!all || !sum) errx(1, "malloc origstats failed");
+    memset(all, 0, sizeof(*all));
+    for (norig = o = 0 ; o < MAXORIGINS ; o++) {
+        memset(sum, 0, sizeof(*sum));
+        for (lcv = 0 ; lcv < g.ninst ; lcv++) {
+            if ((os = is[lcv].origtot[o]) == NULL)
+                continue;
+            if (sum->nrpcs == 0 || os->first < sum->first)
+                sum->first = os->first;
+            if (os->last > sum->last) sum->last = os->last;
+            sum->nrpcs += os->nrpcs;
+            sum->nmsgs += os->nmsgs;
+            hist_merge(&sum->svc, &os->svc);
+            free(os);
+            is[lcv].origtot[o] = NULL;
+        }
+        if (sum->nrpcs == 0)
+            continue;
+        if (norig++ == 0 || sum->first < all->first)
+            all->first = sum->first;
+        if (sum->last > all->last) all->last = sum->last;
+        all->nrpcs += sum->nrpcs;
+        all->nmsgs += sum->nmsgs;
+        hist_merge(&all->svc, &sum->svc);
+        if (show)
+            origin_print("main", o, sum);
+    }
+    if (show) {
+        printf("main: all %d origins: %llu rpcs, ops/sec = %.1f\n", norig,
+               (unsigned long long)all->nrpcs, (all->last > all->first) ?
+               all->nrpcs * 1e9 / (all->last - all->first) : 0.0);
+        if (all->nmsgs)
+            printf("main: all %d origins: %llu msgs, msgs/sec = %.1f\n",
+                   norig, (unsigned long long)all->nmsgs,
+                   (all->last > all->first) ?
+                   all->nmsgs * 1e9 / (all->last - all->first) : 0.0);
+        hist_print("main", "all origins service time", &all->svc);
+    }
+    free(sum);
+    free(all);
+}
+
+/*
+ * origin_print: print the stats for origin o (ops/sec is over the time
+ * from its first RPC to its last reply)
+ */
+static void origin_print(const char *tag, int o, const struct origstats *os) {
+    char what[192];
+
+    pthread_mutex_lock(&g.origlock);   /* origins may be added as we go */
+    snprintf(what, sizeof(what), "origin %d (%s #%d) service time", o,
+             g.origins[o].addr, g.origins[o].inst);
+    pthread_mutex_unlock(&g.origlock);
+    printf("%s: origin %d: %llu rpcs, ops/sec = %.1f\n", tag, o,
+           (unsigned long long)os->nrpcs, (os->last > os->first) ?
+           os->nrpcs * 1e9 / (os->last - os->first) : 0.0);
+    if (os->nmsgs)
+        printf("%s: origin %d: %llu msgs, msgs/sec = %.1f\n", tag, o,
+               (unsigned long long)os->nmsgs, (os->last > os->first) ?
+               os->nmsgs * 1e9 / (os->last - os->first) : 0.0);
+    hist_print(tag, what, &os->svc);
+}
+
+/*
+ * origin_account: count a reply to origin sr->origin that was just
+ * sent (network thread only)
+ */
+static void origin_account(int n, struct sentreq *sr, uint64_t now) {
+    struct origstats *os;
+
+    if (sr->origin < 0 || sr->origin >= MAXORIGINS)
+        return;
+    if ((os = is[n].orig[sr->origin]) == NULL) {
+        os = (struct origstats *)malloc(sizeof(*os));
+        if (!os) errx(1, "malloc origstats failed");
+        memset(os, 0, sizeof(*os));
+        is[n].orig[sr->origin] = os;
+    }
+    if (os->nrpcs == 0 || sr->arrive < os->first)
+        os->first = sr->arrive;
+    os->last = now;
+    os->nrpcs++;
+    os->nmsgs += sr->nmsgs;
+    hist_record(&os->svc, now - sr->arrive);
+}
+
+/*
+ * origin_get: return the origin number for client instance "cinst" at
+ * the address that sent "handle", adding it to the table if it is new.
+ * returns -1 if the table is full.
+ */
+static int origin_get(hg_handle_t handle, int cinst) {
+    struct hg_info *hgi;
+    char addr[128];
+    hg_size_t sz;
+    int o;
+
+    hgi = HG_Get_info(handle);
+    if (!hgi) errx(1, "bad hgi");
+    sz = sizeof(addr);
+    if (HG_Addr_to_string(hgi->hg_class, addr, &sz, hgi->addr) != HG_SUCCESS)
+        snprintf(addr, sizeof(addr), "unknown");
+
+    pthread_mutex_lock(&g.origlock);
+    for (o = 0 ; o < g.norigins ; o++) {
+        if (g.origins[o].inst == cinst && strcmp(g.origins[o].addr, addr) == 0)
+            break;
+    }
+    if (o == g.norigins) {
+        if (o < MAXORIGINS) {
+            snprintf(g.origins[o].addr, sizeof(g.origins[o].addr), "%s", addr);
+            g.origins[o].inst = cinst;
+            g.norigins++;
+        } else {
+            o = -1;
+        }
+    }
+    pthread_mutex_unlock(&g.origlock);
+    return(o);
+}
+
+/*
+ * sentreq_get: get a sentreq for instance n from its free list (or
+ * malloc a new one if the free list is empty)
+ */
+static struct sentreq *sentreq_get(int n, int *np) {
+    struct sentreq *sr;
+
+    if ((sr = is[n].freesr) != NULL) {
+        is[n].freesr = sr->next;
+    } else {
+        sr = (struct sentreq *)malloc(sizeof(*sr));
+        if (!sr) errx(1, "malloc sentreq failed");
+    }
+    sr->np = np;
+    sr->queued = 0;          /* set if it goes through a worker queue */
+    sr->origin = -1;
+    sr->nmsgs = 0;
+    sr->zcopy = 0;           /* set by serve_rpc for zero-copy RPCs */
+    return(sr);
+}
+
+/*
+ * srvr_record: write a results record for an instance (or for all of
+ * them, if instance is -1).  nsec is the time from the first RPC's
+ * arrival to the last reply, so ops/sec is averaged over the whole run
+ * (including any idle time between client phases).  the latency
+ * columns hold the bulk transfer times (if any) and MB/s comes from
+ * the bytes they moved (we don't count RPC payloads, so it is -1 for
+ * "rpc" records).  revops is the reverse RPCs/sec with BIDIR (-1
+ * otherwise).
+ */
+static void srvr_record(int instance, uint64_t nrpcs, uint64_t nsec,
+                        uint64_t cpu, const struct hist *lat, uint64_t bytes,
+                        double revops) {
+    struct runrec rr;
+
+    if (g.results == NULL)
+        return;
+    memset(&rr, 0, sizeof(rr));
+    rr.prog = "srvr";
+    rr.tag = g.tag;
+    rr.transport = g.transport;
+    rr.ninst = g.ninst;
+    rr.instance = instance;
+    rr.layout = (g.fork) ? "per-process" :
+                ((g.shared) ? "shared" : "per-instance");
+    rr.progress = progress_name(&g.prog);
+    rr.affinity = affinity_name(&g.aff);
+    rr.mode = (lat->cnt) ? "bulk" : "rpc";
+    rr.window = rr.rate = rr.insz = rr.outsz = rr.bulksz = rr.batch = -1;
+    rr.nrpcs = nrpcs;
+    rr.nsec = nsec;
+    rr.ops = (nsec) ? nrpcs * 1e9 / nsec : 0;
+    rr.mbs = (lat->cnt) ? ((nsec) ? bytes * 1e3 / nsec : 0) : -1;
+    rr.cpu = cpu;
+    rr.lat = lat;
+    rr.revops = revops;
+    results_write(g.results, &rr);
+}
+
 /*
  * server side funcions....
  */
 
 /*
- * rpchandler: called on the server when a new RPC comes in
+ * handle_instance: return a pointer to the instance number that should
+ * handle a new RPC.
  */
-static hg_return_t rpchandler(hg_handle_t handle) {
+static int *handle_instance(hg_handle_t handle) {
     struct hg_info *hgi;
-    int n, *np;
-    hg_return_t ret;
-    rpcin_t in;
-    rpcout_t out;
-     
+    int *np;
+
     /* gotta extract "n" using handle, 'cause that's the only way pass it */
     hgi = HG_Get_info(handle);
     if (!hgi) errx(1, "bad hgi");
-    np = (int *)HG_Registered_data(hgi->hg_class, hgi->id);
+    if (g.shared)   /* any context can get it, use the one that did */
+        np = (int *)HG_Context_get_data(hgi->context);
+    else
+        np = (int *)HG_Registered_data(hgi->hg_class, hgi->id);
     if (!np) errx(1, "bad np");
+    return(np);
+}
+
+/*
+ * rpchandler: called on the server when a new RPC comes in.  we serve
+ * it here or pass it to our worker pool.
+ */
+static hg_return_t rpchandler(hg_handle_t handle) {
+    uint64_t t0 = now_ns();
+    int n, *np;
+    struct sentreq *sr;
+     
+    np = handle_instance(handle);
     n = *np;
+    if (is[n].progret)
+        hist_record(&is[n].st.queue, t0 - is[n].progret);
 
-    ret = HG_Get_input(handle, &in);
+    sr = sentreq_get(n, np);
+    sr->handle = handle;
+    sr->arrive = t0;
+    sr->zcopy = (HG_Get_info(handle)->id == is[n].myzid);
+    is[n].inflight++;
+    if (g.nworkers == 0) {
+        serve_rpc(n, sr, &is[n].replybuf, &is[n].replybufsz);
+        return(HG_SUCCESS);
+    }
+
+    /* queue it for a worker, then wake one up if they are all asleep */
+    sr->queued = now_ns();
+    while (workq_push(&is[n].wq, sr) != 0)
+        sched_yield();     /* queue full, workers are behind */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&is[n].wqsleepers, __ATOMIC_RELAXED) > 0) {
+        pthread_mutex_lock(&is[n].wqlock);
+        pthread_cond_signal(&is[n].wqcond);
+        pthread_mutex_unlock(&is[n].wqlock);
+    }
+
+    return(HG_SUCCESS);
+}
+
+/*
+ * serve_rpc: decode an RPC, do the synthetic work, and respond using
+ * the given reply buffer (which we grow as needed).  this runs in the
+ * network thread or in a worker, so the timings are stored in the
+ * sentreq for reply_sent_cb() to record.
+ */
+static void serve_rpc(int n, struct sentreq *sr, char **bufp,
+                      int *bufszp) {
+    uint64_t t0;
+    hg_return_t ret;
+    rpcin_t in;
+    rpcout_t out;
+
+    t0 = now_ns();
+    ret = HG_Get_input(sr->handle, &in);
     if (ret != HG_SUCCESS) errx(1, "HG_Get_input failed");
-    if (!g.quiet) printf("%d: got remote input %d\n", n, in.ret);
+    sr->decode = now_ns() - t0;
+    sr->origin = in.origin;
+    if (!g.quiet) printf("%d: got remote input %d (%u bytes)\n", n, in.ret,
+                         in.data.len);
+    if (in.nmsgs)
+        sr->nmsgs = unpack_batch(n, &in);
     out.ret = in.ret * -1;
-    ret = HG_Free_input(handle, &in);
+
+    /* reply with the payload size the client asked for */
+    if ((int)in.outsz > *bufszp) {
+        free(*bufp);
+        *bufp = (char *)malloc(in.outsz);
+        if (!*bufp) errx(1, "malloc replybuf failed");
+        memset(*bufp, 'y', in.outsz);
+        *bufszp = in.outsz;
+    }
+    out.data.len = in.outsz;
+    out.data.buf = *bufp;
+    if (g.bidir)         /* (before we free the payload we send back) */
+        rev_send(n, sr->handle, &in);
+    ret = HG_Free_input(sr->handle, &in);
+
+    if (g.work) {      /* synthetic work: spin for g.work usec */
+        t0 = now_ns() + (uint64_t)g.work * 1000;
+        while (now_ns() < t0)
+            /* spin */ ;
+    }
 
     /* the callback will bump "got" after respond has been sent */
-    ret = HG_Respond(handle, reply_sent_cb, np, &out);
+    sr->start = now_ns();
+    ret = HG_Respond(sr->handle, reply_sent_cb, sr, &out);
     if (ret != HG_SUCCESS) errx(1, "HG_Respond failed");
+}
+
+/*
+ * rev_send: send the reverse RPC for the RPC "handle" (whose input is
+ * "in") back to the client instance that sent it (BIDIR, network thread
+ * only).  the first time we get an RPC from an origin we keep a copy of
+ * its address and register its reverse RPC.
+ */
+static void rev_send(int n, hg_handle_t handle, rpcin_t *in) {
+    struct revpeer *rp;
+    struct revreq *rq;
+    hg_handle_t hand;
+    hg_return_t ret;
+    rpcin_t rin;
+    char name[64];
+
+    if (in->origin < 0 || in->origin >= MAXORIGINS)
+        errx(1, "%d: reverse rpc to bad origin %d", n, in->origin);
+    rp = &is[n].rev[in->origin];
+    if (rp->addr == NULL) {
+        if (HG_Addr_dup(is[n].hgclass, HG_Get_info(handle)->addr,
+                        &rp->addr) != HG_SUCCESS)
+            errx(1, "HG_Addr_dup reverse failed");
+        pthread_mutex_lock(&g.origlock);
+        rp->inst = g.origins[in->origin].inst;
+        pthread_mutex_unlock(&g.origlock);
+        snprintf(name, sizeof(name), "v%d", rp->inst);
+        if (g.shared) pthread_mutex_lock(&g.reglock);
+        rp->id = HG_Register_name(is[n].hgclass, name, hg_proc_rpcin_t,
+                                  hg_proc_rpcout_t, NULL);
+        if (g.shared) pthread_mutex_unlock(&g.reglock);
+    }
+
+    if ((rq = is[n].freerev) != NULL) {
+        is[n].freerev = rq->next;
+    } else {
+        rq = (struct revreq *)malloc(sizeof(*rq));
+        if (!rq) errx(1, "malloc revreq failed");
+    }
+    rq->n = n;
+    rq->origin = in->origin;
+
+    ret = HG_Create(is[n].hgctx, rp->addr, rp->id, &hand);
+    if (ret != HG_SUCCESS) errx(1, "HG_Create reverse failed");
+    if (g.shared && HG_Set_target_id(hand, rp->inst) != HG_SUCCESS)
+        errx(1, "hg set target id failed");
+    rin.ret = in->ret;
+    rin.origin = n;
+    rin.outsz = in->outsz;
+    rin.nmsgs = 0;
+    rin.data = in->data;
+    is[n].revinflight++;
+    __atomic_add_fetch(&g.revout[rq->origin], 1, __ATOMIC_SEQ_CST);
+    rq->start = now_ns();
+    if (is[n].revfirst == 0) is[n].revfirst = rq->start;
+    ret = HG_Forward(hand, rev_cb, rq, &rin);
+    if (ret != HG_SUCCESS) errx(1, "HG_Forward reverse failed");
+}
+
+/*
+ * rev_cb: called when the client's reply to a reverse RPC comes in
+ * (network thread).  the last one to an origin may release its done RPC.
+ */
+static hg_return_t rev_cb(const struct hg_cb_info *cbi) {
+    struct revreq *rq = (struct revreq *)cbi->arg;
+    hg_handle_t hand = cbi->info.forward.handle;
+    uint64_t now = now_ns();
+    int n = rq->n, o = rq->origin;
+    rpcout_t out;
+
+    if (cbi->ret != HG_SUCCESS) errx(1, "%d: reverse rpc failed", n);
+    if (HG_Get_output(hand, &out) != HG_SUCCESS)
+        errx(1, "HG_Get_output reverse failed");
+    HG_Free_output(hand, &out);
+    HG_Destroy(hand);
+
+    hist_record(&is[n].revlat, now - rq->start);
+    is[n].nrev++;
+    is[n].revlast = now;
+    is[n].revinflight--;
+    rq->next = is[n].freerev;
+    is[n].freerev = rq;
+    if (__atomic_sub_fetch(&g.revout[o], 1, __ATOMIC_SEQ_CST) == 0)
+        done_release(o);
+    return(HG_SUCCESS);
+}
+
+/*
+ * unpack_batch: walk the logical messages packed into a batched RPC's
+ * payload and return how many there were.  as with an unbatched RPC
+ * there is nothing to do with a message's data, so we just step over
+ * it.  we exit if the records don't match the RPC's count or run past
+ * the end of the payload.
+ */
+static int unpack_batch(int n, rpcin_t *in) {
+    char *cp = (char *)in->data.buf, *end = cp + in->data.len;
+    uint32_t len;
+    int cnt;
+
+    for (cnt = 0 ; cp < end ; cnt++) {
+        if (end - cp < BATCH_HDR)
+            errx(1, "%d: batch: short message header", n);
+        memcpy(&len, cp, BATCH_HDR);
+        cp += BATCH_HDR;
+        if (len > (uint32_t)(end - cp))
+            errx(1, "%d: batch: message runs past end of payload", n);
+        cp += len;
+    }
+    if (cnt != (int)in->nmsgs)
+        errx(1, "%d: batch: got %d messages, expected %u", n, cnt,
+             in->nmsgs);
+    return(cnt);
+}
+
+/*
+ * run_worker: worker pool thread.  we serve RPCs from our instance's
+ * queue until we are told to stop.
+ */
+static void *run_worker(void *arg) {
+    struct worker *w = (struct worker *)arg;
+    int n = w->n;
+    struct sentreq *sr;
+
+    while ((sr = (struct sentreq *)workq_pop(&is[n].wq)) != NULL ||
+           (sr = worker_wait(n)) != NULL) {
+        sr->wqwait = now_ns() - sr->queued;
+        serve_rpc(n, sr, &w->replybuf, &w->replybufsz);
+    }
+    return(NULL);
+}
+
+/*
+ * worker_wait: wait for an RPC to be queued for instance n's workers.
+ * we poll for a little while and then sleep on the cond var.  returns
+ * NULL if we are told to stop.
+ */
+static struct sentreq *worker_wait(int n) {
+    struct sentreq *sr;
+    uint64_t deadline;
+
+    deadline = now_ns() + WORKER_SPIN * 1000;
+    while (now_ns() < deadline) {
+        if ((sr = (struct sentreq *)workq_pop(&is[n].wq)) != NULL)
+            return(sr);
+    }
+
+    /*
+     * we must be counted as a sleeper before our last look at the
+     * queue, so that rpchandler() either sees us or we see its RPC.
+     */
+    pthread_mutex_lock(&is[n].wqlock);
+    __atomic_add_fetch(&is[n].wqsleepers, 1, __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    while ((sr = (struct sentreq *)workq_pop(&is[n].wq)) == NULL &&
+           !is[n].wqstop) {
+        if (pthread_cond_wait(&is[n].wqcond, &is[n].wqlock) != 0)
+            errx(1, "worker cond wait");
+    }
+    __atomic_sub_fetch(&is[n].wqsleepers, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&is[n].wqlock);
+    return(sr);
+}
+
+/*
+ * bulkhandler: called on the server when a new bulk RPC comes in.
+ * we start the transfer here and respond when it completes.
+ */
+static hg_return_t bulkhandler(hg_handle_t handle) {
+    uint64_t t0 = now_ns();
+    struct hg_info *hgi;
+    int n, *np;
+    hg_return_t ret;
+    struct bulkreq *br;
+    void *bufp;
+
+    hgi = HG_Get_info(handle);
+    if (!hgi) errx(1, "bad hgi");
+    np = handle_instance(handle);
+    n = *np;
+    if (is[n].progret)
+        hist_record(&is[n].st.queue, t0 - is[n].progret);
+
+    br = (struct bulkreq *)malloc(sizeof(*br));
+    if (!br) errx(1, "malloc bulkreq failed");
+    br->np = np;
+    br->handle = handle;
+    br->arrive = t0;
+    is[n].inflight++;
+    t0 = now_ns();
+    ret = HG_Get_input(handle, &br->in);
+    if (ret != HG_SUCCESS) errx(1, "HG_Get_input bulk failed");
+    br->decode = now_ns() - t0;
+    if (!g.quiet) printf("%d: got bulk input %d (%s %llu bytes)\n", n,
+                         br->in.ret, (br->in.op == BULKOP_PULL) ? "pull" :
+                         "push", (unsigned long long)br->in.size);
+
+    /*
+     * grow our local buffer (and its registration) if needed.  earlier
+     * transfers may still be using the old one, so we only free it now
+     * if they are done (otherwise the last one frees it).
+     */
+    if (is[n].bulk == NULL || br->in.size > is[n].bulk->size) {
+        struct bulkmem *bm, *old = is[n].bulk;
+        bm = (struct bulkmem *)malloc(sizeof(*bm));
+        if (!bm) errx(1, "malloc bulkmem failed");
+        bm->buf = (char *)malloc(br->in.size);
+        if (!bm->buf) errx(1, "malloc bulkbuf failed");
+        memset(bm->buf, 'z', br->in.size);
+        bm->size = br->in.size;
+        bm->users = 0;
+        bufp = bm->buf;
+        ret = HG_Bulk_create(is[n].hgclass, 1, &bufp, &bm->size,
+                             HG_BULK_READWRITE, &bm->hand);
+        if (ret != HG_SUCCESS) errx(1, "HG_Bulk_create failed");
+        is[n].bulk = bm;
+        if (old && old->users == 0) {
+            HG_Bulk_free(old->hand);
+            free(old->buf);
+            free(old);
+        }
+    }
+    br->mem = is[n].bulk;
+    br->mem->users++;
+
+    br->start = now_ns();
+    ret = HG_Bulk_transfer(hgi->context, bulk_done_cb, br,
+                           (br->in.op == BULKOP_PULL) ? HG_BULK_PULL :
+                           HG_BULK_PUSH, hgi->addr, br->in.bulk, 0,
+                           br->mem->hand, 0, br->in.size, HG_OP_ID_IGNORE);
+    if (ret != HG_SUCCESS) errx(1, "HG_Bulk_transfer failed");
+
+    return(HG_SUCCESS);
+}
+
+/*
+ * bulkmem_put: a transfer of instance n that used bm is done.  if bm
+ * has been replaced and that was its last transfer, free it.
+ */
+static void bulkmem_put(int n, struct bulkmem *bm) {
+    if (--bm->users > 0 || bm == is[n].bulk)
+        return;
+    HG_Bulk_free(bm->hand);
+    free(bm->buf);
+    free(bm);
+}
+
+/*
+ * bulk_done_cb: called on the server when a bulk transfer completes.
+ * now we can respond to the client.
+ */
+static hg_return_t bulk_done_cb(const struct hg_cb_info *cbi) {
+    struct bulkreq *br = (struct bulkreq *)cbi->arg;
+    int n = *br->np;
+    hg_return_t ret;
+    bulkout_t out;
+    struct sentreq *sr;
+
+    if (cbi->ret != HG_SUCCESS) errx(1, "bulk transfer failed");
+    if (cbi->type != HG_CB_BULK) errx(1, "unexpected bulk cb");
+
+    /* currently safe: only one network thread and we are in it */
+    hist_record(&is[n].bulklat, now_ns() - br->start);
+    is[n].bulkbytes += br->in.size;
+    bulkmem_put(n, br->mem);
+
+    out.ret = br->in.ret * -1;
+
+    /* the callback will bump "got" after respond has been sent */
+    sr = sentreq_get(n, br->np);
+    sr->handle = br->handle;
+    sr->decode = br->decode;
+    sr->arrive = br->arrive;
+    sr->origin = br->in.origin;
+    HG_Free_input(br->handle, &br->in);
+    sr->start = now_ns();
+    ret = HG_Respond(br->handle, reply_sent_cb, sr, &out);
+    if (ret != HG_SUCCESS) errx(1, "HG_Respond bulk failed");
+    free(br);
 
     return(HG_SUCCESS);
 }
@@ -239,16 +1561,176 @@ static hg_return_t rpchandler(hg_handle_t handle) {
  * reply_sent_cb: called after the server's reply to an RPC completes.
  */
 static hg_return_t reply_sent_cb(const struct hg_cb_info *cbi) {
+    struct sentreq *sr = (struct sentreq *)cbi->arg;
+    uint64_t now = now_ns();
     int n;
     if (cbi->type != HG_CB_RESPOND) errx(1, "unexpected sent cb");
-    n = *((int *)cbi->arg);
+    n = *sr->np;
 
     /*
      * currently safe: there is only one network thread and we 
      * are in it (via trigger fn).
      */
+    hist_record(&is[n].st.respond, now - sr->start);
+    origin_account(n, sr, now);
+    if (is[n].got == 0 || sr->arrive < is[n].first)
+        is[n].first = sr->arrive;
+    is[n].last = now;
+    is[n].inflight--;
+    hist_record((sr->zcopy) ? &is[n].st.zdecode : &is[n].st.decode,
+                sr->decode);
+    if (sr->nmsgs)
+        hist_record(&is[n].st.msgs, sr->nmsgs);
+    if (sr->queued)
+        hist_record(&is[n].st.wqwait, sr->wqwait);
+    sr->next = is[n].freesr;
+    is[n].freesr = sr;
     is[n].got++;
 
     /* return handle to the pool for reuse */
     HG_Destroy(cbi->info.respond.handle);
 }
+
+/*
+ * readyhandler: called on the server when a ready RPC comes in.  the
+ * input is the client's instance number.  we reply with its origin
+ * number to let the client know we are up.
+ */
+static hg_return_t readyhandler(hg_handle_t handle) {
+    hg_return_t ret;
+    ready_t in, out;
+
+    ret = HG_Get_input(handle, &in);
+    if (ret != HG_SUCCESS) errx(1, "HG_Get_input ready failed");
+    out.ret = origin_get(handle, in.ret);
+    HG_Free_input(handle, &in);
+    if (!g.quiet) printf("%d: got ready ping (origin %d)\n", in.ret,
+                         out.ret);
+
+    ret = HG_Respond(handle, ready_sent_cb, NULL, &out);
+    if (ret != HG_SUCCESS) errx(1, "HG_Respond ready failed");
+
+    return(HG_SUCCESS);
+}
+
+/*
+ * ready_sent_cb: called after the reply to a ready RPC completes.
+ * ready RPCs are not counted in "got".
+ */
+static hg_return_t ready_sent_cb(const struct hg_cb_info *cbi) {
+    if (cbi->type != HG_CB_RESPOND) errx(1, "unexpected ready sent cb");
+    HG_Destroy(cbi->info.respond.handle);
+    return(HG_SUCCESS);
+}
+
+/*
+ * donehandler: called on the server when the client tells us it is
+ * done sending.  we reply and then exit once the reply has been sent.
+ */
+static hg_return_t donehandler(hg_handle_t handle) {
+    hg_return_t ret;
+    ready_t in, out;
+    int *np, o;
+
+    np = handle_instance(handle);
+    ret = HG_Get_input(handle, &in);
+    if (ret != HG_SUCCESS) errx(1, "HG_Get_input done failed");
+    out.ret = in.ret;
+    HG_Free_input(handle, &in);
+    printf("%d: got done from client instance %d%s\n", *np, out.ret,
+           (g.persist) ? " (persistent, still serving)" : "");
+
+    /* BIDIR: wait for the reverse RPCs to it (see done_release()) */
+    if (g.bidir && (o = origin_get(handle, out.ret)) >= 0) {
+        g.donepend[o].np = np;
+        g.donepend[o].cinst = out.ret;
+        __atomic_store_n(&g.donepend[o].handle, handle, __ATOMIC_SEQ_CST);
+        done_release(o);
+        return(HG_SUCCESS);
+    }
+
+    ret = HG_Respond(handle, done_sent_cb, np, &out);
+    if (ret != HG_SUCCESS) errx(1, "HG_Respond done failed");
+
+    return(HG_SUCCESS);
+}
+
+/*
+ * done_release: answer origin o's held back done RPC if there is one
+ * and no reverse RPCs to it are in flight.  this is called both when
+ * the done RPC comes in and when a reverse RPC completes (from any
+ * instance's network thread), and the atomic exchange makes sure only
+ * one of them answers it.
+ */
+static void done_release(int o) {
+    hg_handle_t handle;
+    hg_return_t ret;
+    ready_t out;
+
+    if (__atomic_load_n(&g.revout[o], __ATOMIC_SEQ_CST) != 0 ||
+        __atomic_load_n(&g.donepend[o].handle, __ATOMIC_SEQ_CST) == NULL)
+        return;
+    handle = __atomic_exchange_n(&g.donepend[o].handle, (hg_handle_t)NULL,
+                                 __ATOMIC_SEQ_CST);
+    if (handle == NULL)
+        return;
+    out.ret = g.donepend[o].cinst;
+    ret = HG_Respond(handle, done_sent_cb, g.donepend[o].np, &out);
+    if (ret != HG_SUCCESS) errx(1, "HG_Respond done failed");
+}
+
+/*
+ * done_sent_cb: called after the reply to a done RPC completes.  this
+ * is what stops the network thread (done RPCs are not counted in "got").
+ */
+static hg_return_t done_sent_cb(const struct hg_cb_info *cbi) {
+    int n;
+    if (cbi->type != HG_CB_RESPOND) errx(1, "unexpected done sent cb");
+    n = *((int *)cbi->arg);
+
+    /* currently safe: we are in instance n's network thread */
+    is[n].done = 1;
+    if (g.shared) __atomic_add_fetch(&g.ndone, 1, __ATOMIC_RELAXED);
+
+    HG_Destroy(cbi->info.respond.handle);
+    return(HG_SUCCESS);
+}
+
+/*
+ * shuthandler: called on the server when a client tells a PERSIST
+ * server to stop.  we stop all instances once the reply has been sent.
+ */
+static hg_return_t shuthandler(hg_handle_t handle) {
+    hg_return_t ret;
+    ready_t in, out;
+
+    ret = HG_Get_input(handle, &in);
+    if (ret != HG_SUCCESS) errx(1, "HG_Get_input shutdown failed");
+    out.ret = in.ret;
+    HG_Free_input(handle, &in);
+    printf("main: got shutdown from client instance %d\n", out.ret);
+
+    ret = HG_Respond(handle, shut_sent_cb, NULL, &out);
+    if (ret != HG_SUCCESS) errx(1, "HG_Respond shutdown failed");
+
+    return(HG_SUCCESS);
+}
+
+/*
+ * shut_sent_cb: called after the reply to a shutdown RPC completes.
+ * without PERSIST we ignore it (the done RPCs stop us).
+ */
+static hg_return_t shut_sent_cb(const struct hg_cb_info *cbi) {
+    if (cbi->type != HG_CB_RESPOND) errx(1, "unexpected shutdown sent cb");
+    __atomic_store_n(&g.stop, 1, __ATOMIC_RELAXED);
+    HG_Destroy(cbi->info.respond.handle);
+    return(HG_SUCCESS);
+}
+
+/*
+ * stop_handler: SIGINT/SIGTERM handler for a PERSIST server.  the
+ * network threads notice within one progress timeout.
+ */
+static void stop_handler(int sig) {
+    __atomic_store_n(&g.stop, 1, __ATOMIC_RELAXED);
+}
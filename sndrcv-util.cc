@@ -0,0 +1,833 @@
+/*
+ * sndrcv-util.cc  test mercury  (helpers shared by client and server)
+ */
+
+#include <dirent.h>
+#include <err.h>
+#include <errno.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "sndrcv-util.h"
+
+/*
+ * thread_cpu_ns: return the CPU time used by a thread in nanoseconds
+ */
+uint64_t thread_cpu_ns(pthread_t thread) {
+    clockid_t cid;
+    struct timespec ts;
+
+    if (pthread_getcpuclockid(thread, &cid) != 0 ||
+        clock_gettime(cid, &ts) != 0)
+        errx(1, "unable to get thread cpu time");
+    return((uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+/*
+ * hist_reset: clear a histogram
+ */
+void hist_reset(struct hist *h) {
+    memset(h, 0, sizeof(*h));
+}
+
+/*
+ * hist_merge: add all the values in src to dst
+ */
+void hist_merge(struct hist *dst, const struct hist *src) {
+    int lcv;
+    if (src->cnt == 0)
+        return;
+    if (dst->cnt == 0 || src->min < dst->min) dst->min = src->min;
+    if (src->max > dst->max) dst->max = src->max;
+    dst->cnt += src->cnt;
+    dst->sum += src->sum;
+    for (lcv = 0 ; lcv < HIST_NBUCKETS ; lcv++) {
+        dst->b[lcv] += src->b[lcv];
+    }
+}
+
+/*
+ * hist_pct: return the value at the given percentile (0 < pct <= 100).
+ * we return the highest value that maps to the selected bucket, clipped
+ * to the range of values we actually recorded.
+ */
+uint64_t hist_pct(const struct hist *h, double pct) {
+    uint64_t want, seen, top;
+    int lcv, shift;
+
+    if (h->cnt == 0)
+        return(0);
+    want = (uint64_t)((pct / 100.0) * h->cnt + 0.5);
+    if (want < 1) want = 1;
+    if (want > h->cnt) want = h->cnt;
+
+    for (seen = 0, lcv = 0 ; lcv < HIST_NBUCKETS ; lcv++) {
+        seen += h->b[lcv];
+        if (seen >= want)
+            break;
+    }
+    if (lcv < HIST_SUB) {
+        top = lcv;
+    } else {
+        shift = (lcv >> HIST_SUBBITS) - 1;
+        top = ((uint64_t)((lcv & (HIST_SUB - 1)) | HIST_SUB) << shift) +
+              ((1ULL << shift) - 1);
+    }
+    if (top < h->min) top = h->min;
+    if (top > h->max) top = h->max;
+    return(top);
+}
+
+/*
+ * hist_print: print a one line summary of a latency histogram (nsec)
+ */
+void hist_print(const char *tag, const char *what, const struct hist *h) {
+    hist_print_unit(tag, what, "nsec", h);
+}
+
+/*
+ * hist_print_unit: print a one line summary of a histogram of values
+ * in the given unit
+ */
+void hist_print_unit(const char *tag, const char *what, const char *unit,
+                     const struct hist *h) {
+    if (h->cnt == 0) {
+        printf("%s: %s: no samples\n", tag, what);
+        return;
+    }
+    printf("%s: %s %s: n=%llu avg=%llu min=%llu p50=%llu p90=%llu "
+           "p99=%llu p99.9=%llu max=%llu\n", tag, what, unit,
+           (unsigned long long)h->cnt, (unsigned long long)(h->sum / h->cnt),
+           (unsigned long long)h->min,
+           (unsigned long long)hist_pct(h, 50.0),
+           (unsigned long long)hist_pct(h, 90.0),
+           (unsigned long long)hist_pct(h, 99.0),
+           (unsigned long long)hist_pct(h, 99.9),
+           (unsigned long long)h->max);
+}
+
+/*
+ * parse_val: parse one number with an optional k/m/g suffix.  returns
+ * a pointer to the character after the value.
+ */
+static const char *parse_val(const char *str, uint64_t *vp) {
+    char *ep;
+    uint64_t v;
+
+    v = strtoull(str, &ep, 0);
+    if (ep == str) errx(1, "bad value in list: %s", str);
+    switch (*ep) {
+    case 'k': case 'K': v <<= 10; ep++; break;
+    case 'm': case 'M': v <<= 20; ep++; break;
+    case 'g': case 'G': v <<= 30; ep++; break;
+    }
+    *vp = v;
+    return(ep);
+}
+
+/*
+ * parse_list: parse a list of values (see header for format)
+ */
+int parse_list(const char *str, uint64_t **valsp) {
+    uint64_t *vals, lo, hi;
+    int nvals, maxvals;
+    const char *cp;
+
+    nvals = 0;
+    maxvals = 8;
+    vals = (uint64_t *)malloc(maxvals * sizeof(*vals));
+    if (!vals) errx(1, "malloc list failed");
+
+    for (cp = str ; *cp ; ) {
+        cp = parse_val(cp, &lo);
+        hi = lo;
+        if (*cp == '-') {
+            cp = parse_val(cp + 1, &hi);
+            if (lo == 0 || hi < lo) errx(1, "bad range in list: %s", str);
+        }
+        if (*cp != ',' && *cp != '\0') errx(1, "bad list: %s", str);
+        if (*cp == ',') cp++;
+
+        for (;;) {
+            if (nvals >= maxvals) {
+                maxvals *= 2;
+                vals = (uint64_t *)realloc(vals, maxvals * sizeof(*vals));
+                if (!vals) errx(1, "realloc list failed");
+            }
+            vals[nvals++] = lo;
+            if (lo == 0 || lo > hi / 2) break;     /* end of range */
+            lo *= 2;
+        }
+    }
+    if (nvals == 0) errx(1, "empty list");
+
+    *valsp = vals;
+    return(nvals);
+}
+
+/*
+ * progress_parse: set a progress policy from a string (NULL for default)
+ */
+void progress_parse(const char *str, struct progress_policy *pp) {
+    pp->mode = PROGRESS_BLOCK;
+    pp->spinus = 0;
+    pp->timeout = 100;
+
+    if (str == NULL || strcmp(str, "block") == 0)
+        return;
+    if (strcmp(str, "busy") == 0) {
+        pp->mode = PROGRESS_BUSY;
+    } else if (strncmp(str, "spin:", 5) == 0 && atoi(str + 5) > 0) {
+        pp->mode = PROGRESS_SPIN;
+        pp->spinus = atoi(str + 5);
+    } else {
+        errx(1, "bad progress policy %s (block, busy, or spin:usec)", str);
+    }
+}
+
+/*
+ * progress_name: return a printable name for a progress policy
+ */
+const char *progress_name(const struct progress_policy *pp) {
+    static __thread char buf[32];
+    switch (pp->mode) {
+    case PROGRESS_BUSY:
+        return("busy");
+    case PROGRESS_SPIN:
+        snprintf(buf, sizeof(buf), "spin:%d", pp->spinus);
+        return(buf);
+    }
+    return("block");
+}
+
+/*
+ * progress: make one HG_Progress() call using the given policy.  this
+ * returns HG_SUCCESS if there may be callbacks to trigger.
+ */
+hg_return_t progress(hg_context_t *ctx, const struct progress_policy *pp) {
+    uint64_t deadline;
+    hg_return_t ret;
+
+    switch (pp->mode) {
+    case PROGRESS_BUSY:
+        return(HG_Progress(ctx, 0));
+    case PROGRESS_SPIN:
+        deadline = now_ns() + (uint64_t)pp->spinus * 1000;
+        do {
+            ret = HG_Progress(ctx, 0);
+            if (ret == HG_SUCCESS)
+                return(ret);
+        } while (now_ns() < deadline);
+        break;
+    }
+
+    return(HG_Progress(ctx, pp->timeout));
+}
+
+/*
+ * core: a physical core and the cpus (hyperthreads) of it we can use
+ */
+struct core {
+    int node;                /* numa node of the core */
+    int pkg;                 /* physical package (socket) id */
+    int id;                  /* core id within the package */
+    int ncpu;                /* number of usable cpus in the core */
+    int cpu[2];              /* the first two usable cpus */
+};
+
+/*
+ * cpu_attr: read an integer topology attribute of a cpu from sysfs.
+ * returns -1 if it is not there.
+ */
+static int cpu_attr(int cpu, const char *attr) {
+    char path[128];
+    FILE *fp;
+    int rv;
+
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/%s",
+             cpu, attr);
+    if ((fp = fopen(path, "r")) == NULL)
+        return(-1);
+    if (fscanf(fp, "%d", &rv) != 1) rv = -1;
+    fclose(fp);
+    return(rv);
+}
+
+/*
+ * cpu_node: return the numa node of a cpu (0 if we can't tell)
+ */
+static int cpu_node(int cpu) {
+    char path[128];
+    struct dirent *de;
+    DIR *dp;
+    int node;
+
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+    if ((dp = opendir(path)) == NULL)
+        return(0);
+    node = 0;
+    while ((de = readdir(dp)) != NULL) {
+        if (strncmp(de->d_name, "node", 4) == 0 &&
+            sscanf(de->d_name + 4, "%d", &node) == 1)
+            break;
+    }
+    closedir(dp);
+    return(node);
+}
+
+/*
+ * get_cores: build a list of the physical cores we are allowed to run
+ * on, ordered by numa node (then by the order we found them in).
+ * returns the number of cores in the malloc'd list.
+ */
+static int get_cores(struct core **coresp) {
+    cpu_set_t cs;
+    struct core *cores, tmp;
+    int cpu, pkg, id, lcv, ncores, k;
+
+    if (sched_getaffinity(0, sizeof(cs), &cs) != 0)
+        errx(1, "sched_getaffinity failed");
+    cores = (struct core *)malloc(CPU_COUNT(&cs) * sizeof(*cores));
+    if (!cores) errx(1, "malloc cores failed");
+
+    for (ncores = 0, cpu = 0 ; cpu < CPU_SETSIZE ; cpu++) {
+        if (!CPU_ISSET(cpu, &cs))
+            continue;
+        pkg = cpu_attr(cpu, "physical_package_id");
+        id = cpu_attr(cpu, "core_id");
+        for (lcv = 0 ; lcv < ncores ; lcv++) {
+            if (id >= 0 && cores[lcv].pkg == pkg && cores[lcv].id == id)
+                break;
+        }
+        if (lcv == ncores) {         /* new core */
+            cores[lcv].node = cpu_node(cpu);
+            cores[lcv].pkg = pkg;
+            cores[lcv].id = id;
+            cores[lcv].ncpu = 0;
+            ncores++;
+        }
+        if (cores[lcv].ncpu < 2)
+            cores[lcv].cpu[cores[lcv].ncpu] = cpu;
+        cores[lcv].ncpu++;
+    }
+
+    /* stable insertion sort by node */
+    for (lcv = 1 ; lcv < ncores ; lcv++) {
+        tmp = cores[lcv];
+        for (k = lcv ; k > 0 && cores[k-1].node > tmp.node ; k--)
+            cores[k] = cores[k-1];
+        cores[k] = tmp;
+    }
+
+    *coresp = cores;
+    return(ncores);
+}
+
+/*
+ * affinity_parse: make an affinity plan for ninst instances from a
+ * string (NULL for the default, no pinning).  the presets are "core"
+ * (app and network thread of an instance share one cpu), "sibling"
+ * (they run on the two hyperthreads of one core), "numa" (they run on
+ * two different cores of the same numa node), and "cross" (they run
+ * on cores of two different numa nodes).  each instance gets its own
+ * core(s) until we run out, then we wrap around.  "cpus:a,b,c,..."
+ * gives the cpus to use directly: instance n's app thread runs on the
+ * (2n)th cpu in the list and its network thread on the (2n+1)th.
+ */
+void affinity_parse(const char *str, int ninst, struct affinity_plan *ap) {
+    struct core *cores, **use, **alt;
+    uint64_t *list;
+    int ncores, nuse, nalt, lcv, need, node;
+
+    ap->mode = AFF_NONE;
+    ap->ninst = ninst;
+    ap->app = (int *)malloc(ninst * sizeof(*ap->app));
+    ap->net = (int *)malloc(ninst * sizeof(*ap->net));
+    if (!ap->app || !ap->net) errx(1, "malloc affinity plan failed");
+    for (lcv = 0 ; lcv < ninst ; lcv++) {
+        ap->app[lcv] = ap->net[lcv] = -1;
+    }
+    if (str == NULL || strcmp(str, "none") == 0)
+        return;
+
+    if (strncmp(str, "cpus:", 5) == 0) {
+        ap->mode = AFF_LIST;
+        nuse = parse_list(str + 5, &list);
+        for (lcv = 0 ; lcv < ninst ; lcv++) {
+            ap->app[lcv] = list[(2 * lcv) % nuse];
+            ap->net[lcv] = list[(2 * lcv + 1) % nuse];
+        }
+        if (nuse < 2 * ninst)
+            warnx("affinity: cpu list too short, wrapped around");
+        free(list);
+        return;
+    }
+    if (strcmp(str, "core") == 0)
+        ap->mode = AFF_CORE;
+    else if (strcmp(str, "sibling") == 0)
+        ap->mode = AFF_SIBLING;
+    else if (strcmp(str, "numa") == 0)
+        ap->mode = AFF_NUMA;
+    else if (strcmp(str, "cross") == 0)
+        ap->mode = AFF_CROSS;
+    else
+        errx(1, "bad affinity %s (none, core, sibling, numa, cross, "
+             "or cpus:list)", str);
+
+    /*
+     * "use" is the list of cores we give out in order.  for numa we
+     * pair up cores on the same node, for cross we pair cores from
+     * the first node ("use") with cores from the next one ("alt").
+     */
+    ncores = get_cores(&cores);
+    use = (struct core **)malloc(ncores * sizeof(*use));
+    alt = (struct core **)malloc(ncores * sizeof(*alt));
+    if (!use || !alt) errx(1, "malloc affinity cores failed");
+    nuse = nalt = 0;
+    for (lcv = 0 ; lcv < ncores ; lcv++) {
+        switch (ap->mode) {
+        case AFF_SIBLING:
+            if (cores[lcv].ncpu > 1) use[nuse++] = &cores[lcv];
+            break;
+        case AFF_NUMA:      /* pairs: drop a node's odd core out */
+            if (nuse % 2 && use[nuse-1]->node != cores[lcv].node) nuse--;
+            use[nuse++] = &cores[lcv];
+            break;
+        case AFF_CROSS:
+            node = cores[0].node;
+            if (cores[lcv].node == node)
+                use[nuse++] = &cores[lcv];
+            else if (nalt == 0 || alt[0]->node == cores[lcv].node)
+                alt[nalt++] = &cores[lcv];
+            break;
+        default:
+            use[nuse++] = &cores[lcv];
+        }
+    }
+    if (ap->mode == AFF_NUMA && nuse % 2) nuse--;
+
+    if (nuse == 0 || (ap->mode == AFF_CROSS && nalt == 0))
+        errx(1, "affinity %s: not enough cpus/cores/nodes", str);
+    for (lcv = 0 ; lcv < ninst ; lcv++) {
+        switch (ap->mode) {
+        case AFF_CORE:
+            ap->app[lcv] = ap->net[lcv] = use[lcv % nuse]->cpu[0];
+            break;
+        case AFF_SIBLING:
+            ap->app[lcv] = use[lcv % nuse]->cpu[0];
+            ap->net[lcv] = use[lcv % nuse]->cpu[1];
+            break;
+        case AFF_NUMA:
+            ap->app[lcv] = use[(2 * lcv) % nuse]->cpu[0];
+            ap->net[lcv] = use[(2 * lcv + 1) % nuse]->cpu[0];
+            break;
+        case AFF_CROSS:
+            ap->app[lcv] = use[lcv % nuse]->cpu[0];
+            ap->net[lcv] = alt[lcv % nalt]->cpu[0];
+            break;
+        }
+    }
+    need = (ap->mode == AFF_NUMA) ? 2 * ninst : ninst;
+    if (need > nuse || (ap->mode == AFF_CROSS && ninst > nalt))
+        warnx("affinity %s: more instances than cores, wrapped around", str);
+    free(use);
+    free(alt);
+    free(cores);
+}
+
+/*
+ * affinity_name: return a printable name for an affinity plan's mode
+ */
+const char *affinity_name(const struct affinity_plan *ap) {
+    switch (ap->mode) {
+    case AFF_CORE:
+        return("core");
+    case AFF_SIBLING:
+        return("sibling");
+    case AFF_NUMA:
+        return("numa");
+    case AFF_CROSS:
+        return("cross");
+    case AFF_LIST:
+        return("cpus");
+    }
+    return("none");
+}
+
+/*
+ * affinity_pin: pin the calling thread to a cpu (do nothing if cpu < 0)
+ */
+void affinity_pin(int cpu) {
+    cpu_set_t cs;
+
+    if (cpu < 0)
+        return;
+    CPU_ZERO(&cs);
+    CPU_SET(cpu, &cs);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cs), &cs) != 0)
+        errx(1, "unable to pin thread to cpu %d", cpu);
+}
+
+/*
+ * workq_init: init a work queue with room for at least size items
+ */
+void workq_init(struct workq *q, int size) {
+    uint64_t lcv, nc;
+
+    for (nc = 2 ; nc < (uint64_t)size ; nc *= 2)
+        /* round up to a power of 2 */ ;
+    q->cells = (struct workq_cell *)malloc(nc * sizeof(*q->cells));
+    if (!q->cells) errx(1, "malloc workq failed");
+    for (lcv = 0 ; lcv < nc ; lcv++) {
+        q->cells[lcv].seq = lcv;
+        q->cells[lcv].item = NULL;
+    }
+    q->mask = nc - 1;
+    q->head = q->tail = 0;
+}
+
+/*
+ * workq_free: free a work queue's ring (any items on it are dropped)
+ */
+void workq_free(struct workq *q) {
+    free(q->cells);
+    q->cells = NULL;
+}
+
+/*
+ * workq_push: add an item to the queue.  a cell is free for position
+ * pos when its seq is pos.  we claim it by advancing head and then
+ * publish the item by setting seq to pos+1.
+ */
+int workq_push(struct workq *q, void *item) {
+    struct workq_cell *c;
+    uint64_t pos, seq;
+    int64_t dif;
+
+    pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+    for (;;) {
+        c = &q->cells[pos & q->mask];
+        seq = __atomic_load_n(&c->seq, __ATOMIC_ACQUIRE);
+        dif = (int64_t)seq - (int64_t)pos;
+        if (dif == 0) {
+            if (__atomic_compare_exchange_n(&q->head, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED))
+                break;          /* pos is ours, else pos was reloaded */
+        } else if (dif < 0) {
+            return(-1);         /* full */
+        } else {
+            pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+        }
+    }
+    c->item = item;
+    __atomic_store_n(&c->seq, pos + 1, __ATOMIC_RELEASE);
+    return(0);
+}
+
+/*
+ * workq_pop: remove an item from the queue.  a cell at position pos is
+ * full when its seq is pos+1.  after we take the item we free the cell
+ * for the next lap of the ring by setting seq to pos+size.
+ */
+void *workq_pop(struct workq *q) {
+    struct workq_cell *c;
+    uint64_t pos, seq;
+    int64_t dif;
+    void *item;
+
+    pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+    for (;;) {
+        c = &q->cells[pos & q->mask];
+        seq = __atomic_load_n(&c->seq, __ATOMIC_ACQUIRE);
+        dif = (int64_t)seq - (int64_t)(pos + 1);
+        if (dif == 0) {
+            if (__atomic_compare_exchange_n(&q->tail, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED))
+                break;
+        } else if (dif < 0) {
+            return(NULL);       /* empty */
+        } else {
+            pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+        }
+    }
+    item = c->item;
+    __atomic_store_n(&c->seq, pos + q->mask + 1, __ATOMIC_RELEASE);
+    return(item);
+}
+
+/*
+ * results header: the CSV column names.  new columns only ever go on
+ * the end, but a file started by an older build has a shorter header.
+ */
+static const char results_hdr[] =
+    "prog,tag,transport,ninst,instance,layout,progress,"
+    "affinity,mode,window,rate,insize,outsize,bulksize,handles,"
+    "nrpcs,nsec,ops_per_sec,mb_per_sec,cpu_nsec,cpu_nsec_per_rpc,"
+    "lat_avg,lat_min,lat_p50,lat_p90,lat_p99,lat_p999,lat_max,"
+    "batch,nmsgs,msgs_per_sec,msg_lat_p50,msg_lat_p99,completion,"
+    "progress_thread,reverse_ops_per_sec\n";
+
+/*
+ * results_open: open a results file for appending records.  we write
+ * the CSV header if the file is empty or if its last header line is
+ * not ours (i.e. it was written by a build with different columns), so
+ * the records that follow a header always match it.  returns NULL if
+ * path is NULL.
+ */
+FILE *results_open(const char *path) {
+    FILE *fp;
+    char line[sizeof(results_hdr)];
+    int bol, match;
+
+    if (path == NULL)
+        return(NULL);
+    if ((fp = fopen(path, "a+")) == NULL)
+        err(1, "unable to open results file %s", path);
+
+    /* find the last header line (a line that starts with "prog,") */
+    rewind(fp);
+    match = 0;
+    bol = 1;                      /* at the start of a line */
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        if (bol && strncmp(line, "prog,", 5) == 0)
+            match = (strcmp(line, results_hdr) == 0);
+        bol = (strchr(line, '\n') != NULL);
+    }
+    if (!match) {
+        fputs(results_hdr, fp);   /* "a+" mode: always goes on the end */
+        fflush(fp);
+    }
+    return(fp);
+}
+
+/*
+ * results_write: append a record to a results file (NULL fp is a no-op).
+ * we write each record with one fprintf() and flush it, so records from
+ * different threads don't get mixed up.
+ */
+void results_write(FILE *fp, const struct runrec *rr) {
+    char inst[16], lat[256], msg[128], rev[32];
+    const struct hist *h = rr->lat;
+
+    if (fp == NULL)
+        return;
+    if (rr->instance < 0)
+        snprintf(inst, sizeof(inst), "all");
+    else
+        snprintf(inst, sizeof(inst), "%d", rr->instance);
+    if (h && h->cnt)
+        snprintf(lat, sizeof(lat), "%llu,%llu,%llu,%llu,%llu,%llu,%llu",
+                 (unsigned long long)(h->sum / h->cnt),
+                 (unsigned long long)h->min,
+                 (unsigned long long)hist_pct(h, 50.0),
+                 (unsigned long long)hist_pct(h, 90.0),
+                 (unsigned long long)hist_pct(h, 99.0),
+                 (unsigned long long)hist_pct(h, 99.9),
+                 (unsigned long long)h->max);
+    else
+        snprintf(lat, sizeof(lat), ",,,,,,");
+    h = rr->msglat;
+    if (rr->batch > 0 && h && h->cnt)
+        snprintf(msg, sizeof(msg), "%llu,%.1f,%llu,%llu",
+                 (unsigned long long)rr->nmsgs, rr->mops,
+                 (unsigned long long)hist_pct(h, 50.0),
+                 (unsigned long long)hist_pct(h, 99.0));
+    else
+        snprintf(msg, sizeof(msg), ",,,");
+    if (rr->revops >= 0)
+        snprintf(rev, sizeof(rev), "%.1f", rr->revops);
+    else
+        rev[0] = '\0';
+
+#define S(X) ((X) ? (X) : "")
+    fprintf(fp, "%s,%s,%s,%d,%s,%s,%s,%s,%s,%d,%d,%d,%d,%d,%s,%llu,%llu,"
+            "%.1f,%.3f,%llu,%llu,%s,%d,%s,%s,%s,%s\n", S(rr->prog),
+            S(rr->tag), S(rr->transport), rr->ninst, inst, S(rr->layout),
+            S(rr->progress), S(rr->affinity), S(rr->mode), rr->window,
+            rr->rate, rr->insz, rr->outsz, rr->bulksz, S(rr->handles),
+            (unsigned long long)rr->nrpcs, (unsigned long long)rr->nsec,
+            rr->ops, rr->mbs, (unsigned long long)rr->cpu,
+            (unsigned long long)((rr->nrpcs) ? rr->cpu / rr->nrpcs : 0), lat,
+            rr->batch, msg, S(rr->completion),
+            S(rr->progthread), rev);
+#undef S
+    fflush(fp);
+}
+
+/*
+ * transport_name: copy the transport part of an address spec (the part
+ * before "://", e.g. "bmi+tcp") to buf
+ */
+void transport_name(const char *spec, char *buf, int len) {
+    const char *cp;
+    int tlen;
+
+    cp = strstr(spec, "://");
+    tlen = (cp) ? cp - spec : (int)strlen(spec);
+    if (tlen >= len) tlen = len - 1;
+    memcpy(buf, spec, tlen);
+    buf[tlen] = '\0';
+}
+
+/*
+ * peertab_init: make an empty peer table with n entries
+ */
+void peertab_init(struct peertab *pt, int n) {
+    pt->n = n;
+    pt->addr = (char (*)[PEER_ADDRLEN])malloc(n * PEER_ADDRLEN);
+    pt->ready = (int *)malloc(n * sizeof(int));
+    if (!pt->addr || !pt->ready) errx(1, "malloc peertab failed");
+    memset(pt->ready, 0, n * sizeof(int));
+}
+
+/*
+ * peertab_free: free a peer table's entries
+ */
+void peertab_free(struct peertab *pt) {
+    free(pt->addr);
+    free(pt->ready);
+    pt->addr = NULL;
+    pt->ready = NULL;
+    pt->n = 0;
+}
+
+/*
+ * peertab_publish: put the self address of class "cls" in entry i
+ */
+void peertab_publish(struct peertab *pt, int i, hg_class_t *cls) {
+    hg_addr_t self;
+    hg_size_t sz = PEER_ADDRLEN;
+
+    if (i < 0 || i >= pt->n) errx(1, "peertab_publish: bad entry %d", i);
+    if (HG_Addr_self(cls, &self) != HG_SUCCESS)
+        errx(1, "HG_Addr_self failed");
+    if (HG_Addr_to_string(cls, pt->addr[i], &sz, self) != HG_SUCCESS)
+        errx(1, "HG_Addr_to_string failed");
+    HG_Addr_free(cls, self);
+    __atomic_store_n(&pt->ready[i], 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * peertab_wait: wait for entry i to be published and copy it to buf
+ */
+void peertab_wait(struct peertab *pt, int i, char *buf, int len) {
+    if (i < 0 || i >= pt->n) errx(1, "peertab_wait: bad entry %d", i);
+    while (__atomic_load_n(&pt->ready[i], __ATOMIC_ACQUIRE) == 0)
+        usleep(1000);
+    snprintf(buf, len, "%s", pt->addr[i]);
+}
+
+/*
+ * shm: the shared segment (FORK only).  "used" is only changed with
+ * atomics, since the instance processes allocate from it concurrently.
+ */
+#define SHM_ALIGN 64         /* keep allocations on their own cache lines */
+
+static struct {
+    char *base;              /* start of the segment (NULL=none) */
+    size_t size;             /* its size */
+    size_t *used;            /* bytes allocated (in the segment) */
+} shm;
+
+/*
+ * shm_init: map a shared segment of (at least) size bytes.  this must
+ * be done before we fork the instances.
+ */
+void shm_init(size_t size) {
+    void *p;
+
+    size += SHM_ALIGN;       /* room for "used" */
+    p = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS,
+             -1, 0);
+    if (p == MAP_FAILED)
+        err(1, "unable to map %zu byte shared segment", size);
+    shm.base = (char *)p;
+    shm.size = size;
+    shm.used = (size_t *)p;
+    *shm.used = SHM_ALIGN;
+}
+
+/*
+ * shm_alloc: allocate size bytes of zeroed memory from the shared
+ * segment (or with malloc if there is no segment).  exits if we run out.
+ */
+void *shm_alloc(size_t size) {
+    size_t off;
+    void *p;
+
+    if (shm.base == NULL) {
+        if ((p = calloc(1, size)) == NULL) errx(1, "malloc failed");
+        return(p);
+    }
+    size = (size + SHM_ALIGN - 1) & ~((size_t)SHM_ALIGN - 1);
+    off = __atomic_fetch_add(shm.used, size, __ATOMIC_RELAXED);
+    if (off + size > shm.size)
+        errx(1, "shared segment full (%zu bytes)", shm.size);
+    return(shm.base + off);       /* a new mapping is already zero */
+}
+
+/*
+ * shm_free: free memory from shm_alloc() (a no-op for segment memory)
+ */
+void shm_free(void *p) {
+    if (shm.base == NULL || (char *)p < shm.base ||
+        (char *)p >= shm.base + shm.size)
+        free(p);
+}
+
+/*
+ * shm_mapped: return non-zero if we have a shared segment
+ */
+int shm_mapped() {
+    return(shm.base != NULL);
+}
+
+/*
+ * fork_instance: fork a child process that runs fn(arg) and exits.
+ * the child gets the time left on our alarm (alarms are not inherited).
+ * returns the child's pid.
+ */
+pid_t fork_instance(void *(*fn)(void *), void *arg) {
+    unsigned int left;
+    pid_t pid;
+
+    fflush(NULL);            /* so buffered output isn't printed twice */
+    left = alarm(0);
+    alarm(left);
+    if ((pid = fork()) < 0)
+        err(1, "fork failed");
+    if (pid == 0) {
+        alarm(left);
+        fn(arg);
+        fflush(NULL);
+        _exit(0);
+    }
+    return(pid);
+}
+
+/*
+ * wait_instances: wait for n instance processes to exit.  returns the
+ * number of them that failed (exited non-zero or were killed).
+ */
+int wait_instances(pid_t *pids, int n) {
+    int lcv, status, nfail;
+
+    for (nfail = lcv = 0 ; lcv < n ; lcv++) {
+        while (waitpid(pids[lcv], &status, 0) < 0) {
+            if (errno != EINTR)
+                err(1, "waitpid failed");
+        }
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            warnx("instance %d process failed (status %#x)", lcv, status);
+            nfail++;
+        }
+    }
+    return(nfail);
+}
@@ -0,0 +1,249 @@
+/*
+ * sndrcv-util.h  test mercury  (helpers shared by client and server)
+ */
+
+/*
+ * this file contains small helper routines that are used by both
+ * the client and the server programs (timing, latency histograms,
+ * parsing lists of values from the environment, the policy used
+ * by the network threads to call HG_Progress(), thread placement, a
+ * lock-free work queue, writing machine-readable result records,
+ * passing server addresses to a client in the same process, and running
+ * each instance in its own process).
+ */
+
+#ifndef SNDRCV_UTIL_H
+#define SNDRCV_UTIL_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include <sys/types.h>
+
+#include <mercury.h>
+
+/*
+ * now_ns: return the current CLOCK_MONOTONIC time in nanoseconds
+ */
+static inline uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+/*
+ * thread_cpu_ns: return the CPU time used by a thread in nanoseconds
+ */
+uint64_t thread_cpu_ns(pthread_t thread);
+
+/*
+ * hist: log-bucketed latency histogram (in the style of HdrHistogram).
+ * each power of two is split into HIST_SUB linear sub-buckets, so the
+ * relative error of a recorded value is at most 1/HIST_SUB (~3%).
+ * values smaller than HIST_SUB are recorded exactly.   the bucket array
+ * is fixed size, so recording a value never allocates memory.
+ */
+#define HIST_SUBBITS 5                         /* log2(sub-buckets) */
+#define HIST_SUB     (1 << HIST_SUBBITS)       /* sub-buckets per pow2 */
+#define HIST_NBUCKETS ((64 - HIST_SUBBITS + 1) << HIST_SUBBITS)
+
+struct hist {
+    uint64_t cnt;                  /* number of values recorded */
+    uint64_t sum;                  /* sum of values (for the average) */
+    uint64_t min;                  /* smallest value recorded */
+    uint64_t max;                  /* largest value recorded */
+    uint64_t b[HIST_NBUCKETS];     /* bucket counts */
+};
+
+/*
+ * hist_bucket: map a value to its bucket index
+ */
+static inline int hist_bucket(uint64_t v) {
+    int msb;
+    if (v < HIST_SUB)
+        return(v);
+    msb = 63 - __builtin_clzll(v);
+    return(((msb - HIST_SUBBITS + 1) << HIST_SUBBITS) +
+           ((v >> (msb - HIST_SUBBITS)) & (HIST_SUB - 1)));
+}
+
+/*
+ * hist_record: add a value to a histogram (hot path, no allocation)
+ */
+static inline void hist_record(struct hist *h, uint64_t v) {
+    if (h->cnt == 0 || v < h->min) h->min = v;
+    if (v > h->max) h->max = v;
+    h->cnt++;
+    h->sum += v;
+    h->b[hist_bucket(v)]++;
+}
+
+void hist_reset(struct hist *h);                        /* zero it */
+void hist_merge(struct hist *dst, const struct hist *src);  /* dst += src */
+uint64_t hist_pct(const struct hist *h, double pct);    /* percentile */
+void hist_print(const char *tag, const char *what, const struct hist *h);
+void hist_print_unit(const char *tag, const char *what, const char *unit,
+                     const struct hist *h);     /* for values not in nsec */
+
+/*
+ * parse_list: parse a list of values like "1,2,8" or "8-64k" into a
+ * malloc'd array (caller frees).  a "lo-hi" range steps from lo to hi by
+ * doubling.  values may have a k, m, or g suffix (powers of 1024).
+ * returns the number of values in the list.  exits on a bad list.
+ */
+int parse_list(const char *str, uint64_t **valsp);
+
+/*
+ * progress policy: how the network thread waits for work in HG_Progress().
+ * "block" blocks for up to timeout msec (the original behavior), "busy"
+ * polls with a zero timeout, and "spin" polls for spinus microseconds
+ * before it blocks.  set from the PROGRESS environment variable:
+ * "block", "busy", or "spin:N" (N in usec).
+ */
+#define PROGRESS_BLOCK 0     /* block in HG_Progress (default) */
+#define PROGRESS_BUSY  1     /* busy poll HG_Progress with 0 timeout */
+#define PROGRESS_SPIN  2     /* spin for a while, then block */
+
+struct progress_policy {
+    int mode;                /* PROGRESS_* */
+    int spinus;              /* spin time (PROGRESS_SPIN only) */
+    unsigned int timeout;    /* blocking timeout (msec) */
+};
+
+void progress_parse(const char *str, struct progress_policy *pp);
+const char *progress_name(const struct progress_policy *pp);
+hg_return_t progress(hg_context_t *ctx, const struct progress_policy *pp);
+
+/*
+ * affinity plan: where to pin each instance's app (run_instance) thread
+ * and network (run_network) thread.  set from the AFFINITY environment
+ * variable (see affinity_parse() for the presets).  the plan is made
+ * from the CPUs we are allowed to run on and the topology in sysfs.
+ */
+#define AFF_NONE    0        /* no pinning (default) */
+#define AFF_CORE    1        /* app and network thread on the same cpu */
+#define AFF_SIBLING 2        /* on the two hyperthreads of one core */
+#define AFF_NUMA    3        /* on two cores of the same numa node */
+#define AFF_CROSS   4        /* on cores of two different numa nodes */
+#define AFF_LIST    5        /* on cpus from a list (app, net, app, ...) */
+
+struct affinity_plan {
+    int mode;                /* AFF_* */
+    int ninst;               /* number of instances in the plan */
+    int *app;                /* cpu for instance's app thread (-1=none) */
+    int *net;                /* cpu for instance's network thread */
+};
+
+void affinity_parse(const char *str, int ninst, struct affinity_plan *ap);
+const char *affinity_name(const struct affinity_plan *ap);
+void affinity_pin(int cpu);  /* pin calling thread to cpu (-1=don't) */
+
+/*
+ * workq: a bounded lock-free queue of pointers that any number of
+ * threads can push to and pop from (a ring of cells with sequence
+ * numbers, after Dmitry Vyukov's MPMC queue).  the size is rounded up
+ * to a power of 2.  push returns -1 if the queue is full and pop returns
+ * NULL if it is empty; neither blocks or allocates memory.
+ */
+struct workq_cell {
+    uint64_t seq;            /* sequence number (owner of the cell) */
+    void *item;              /* the queued item */
+};
+
+struct workq {
+    struct workq_cell *cells;     /* ring of cells */
+    uint64_t mask;                /* ring size - 1 */
+    char pad0[64];                /* keep head and tail on own lines */
+    uint64_t head;                /* next position to push */
+    char pad1[64];
+    uint64_t tail;                /* next position to pop */
+    char pad2[64];
+};
+
+void workq_init(struct workq *q, int size);
+void workq_free(struct workq *q);
+int workq_push(struct workq *q, void *item);    /* 0 on success */
+void *workq_pop(struct workq *q);
+
+/*
+ * result records: if the RESULTS environment variable names a file, we
+ * append one CSV line to it for each thing we measure (e.g. for each
+ * instance and phase, plus one for all instances together), so runs
+ * can be compared by scripts.  the header line is written when the file
+ * is empty.  string fields that don't apply are left empty ("" or NULL)
+ * and numbers that don't apply are -1.
+ */
+struct runrec {
+    const char *prog;        /* "client" or "srvr" */
+    const char *tag;         /* user label for the run ($RESULTS_TAG) */
+    const char *transport;   /* e.g. "bmi+tcp" */
+    int ninst;               /* number of instances */
+    int instance;            /* instance number, -1 for all of them */
+    const char *layout;      /* "per-instance" or "shared" class */
+    const char *progress;    /* progress policy */
+    const char *affinity;    /* affinity preset */
+    const char *mode;        /* "rpc", "bulk-pull", or "bulk-push" */
+    int window;              /* max RPCs in flight (0=unlimited) */
+    int rate;                /* open loop rate (0=closed loop) */
+    int insz;                /* request payload size */
+    int outsz;               /* reply payload size */
+    int bulksz;              /* bulk transfer size */
+    const char *handles;     /* "create" or "pool" */
+    uint64_t nrpcs;          /* number of RPCs */
+    uint64_t nsec;           /* wall time (nsec) */
+    double ops;              /* RPCs/sec */
+    double mbs;              /* MB/sec of data moved */
+    uint64_t cpu;            /* cpu time used (nsec) */
+    const struct hist *lat;  /* latency histogram (NULL=none) */
+    int batch;               /* max messages per RPC (0=not batched) */
+    uint64_t nmsgs;          /* number of logical messages (batch only) */
+    double mops;             /* logical messages/sec (batch only) */
+    const struct hist *msglat;  /* message latency histogram (NULL=none) */
+    const char *completion;  /* "lock" or "lock-free" completion path */
+    const char *progthread;  /* thread that drives progress ("network") */
+    double revops;           /* reverse (server->client) RPCs/sec (BIDIR) */
+};
+
+FILE *results_open(const char *path);   /* open results file (append) */
+void results_write(FILE *fp, const struct runrec *rr);   /* add a record */
+void transport_name(const char *spec, char *buf, int len);  /* "na+x" */
+
+/*
+ * peer table: when the client and server run in one process (see
+ * sndrcv-loop.cc) each server instance publishes its listening address
+ * here once it is up and the client uses these addresses instead of
+ * its remote address spec.  this is what lets us use transports whose
+ * addresses are assigned at init time (e.g. na+sm).
+ */
+#define PEER_ADDRLEN 256
+
+struct peertab {
+    int n;                        /* number of entries */
+    char (*addr)[PEER_ADDRLEN];   /* listening address of each instance */
+    int *ready;                   /* set when addr[i] is valid (atomic) */
+};
+
+void peertab_init(struct peertab *pt, int n);
+void peertab_free(struct peertab *pt);
+void peertab_publish(struct peertab *pt, int i, hg_class_t *cls);
+void peertab_wait(struct peertab *pt, int i, char *buf, int len);
+
+/*
+ * process per instance: with FORK each instance runs in its own child
+ * process instead of its own thread.  the parent maps a shared memory
+ * segment before it forks and everything the instances report back to
+ * main is allocated from it with shm_alloc(), so it is at the same
+ * address in every process.  shm_alloc() just returns zeroed malloc'd
+ * memory if there is no segment, so the thread mode can use the same
+ * code.  shm_free() frees malloc'd memory and ignores segment memory
+ * (the segment is never freed).
+ */
+void shm_init(size_t size);         /* map a shared segment (before fork) */
+void *shm_alloc(size_t size);       /* zeroed memory, shared if mapped */
+void shm_free(void *p);
+int shm_mapped(void);               /* non-zero if we have a segment */
+pid_t fork_instance(void *(*fn)(void *), void *arg);  /* run fn in child */
+int wait_instances(pid_t *pids, int n);  /* wait for them, # that failed */
+
+#endif /* SNDRCV_UTIL_H */